@@ -11,6 +11,7 @@
 #ifdef __KERNEL__
 #include <linux/string.h>
 #include <linux/slab.h>
+#include "aesd-entry-alloc.h"
 #else
 #include <string.h>
 #include <stdlib.h>
@@ -35,6 +36,9 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     size_t seen_so_far = 0;
     for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
         __u8 idx = (i + buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        /* Empty slots hold no bytes and would underflow max_index below */
+        if (buffer->entry[idx].size == 0)
+            continue;
         size_t max_index = seen_so_far + buffer->entry[idx].size - 1;
         if (char_offset <= max_index) {
             size_t idx_internal = char_offset - seen_so_far;
@@ -46,6 +50,52 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     return NULL;
 }
 
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param entry_index the zero referenced index of the entry to look for, counting from the oldest entry
+ * @param entry_offset the zero referenced byte within that entry
+ * @param char_offset_rtn is a pointer specifying a location to store the position corresponding to
+ *      entry_index and entry_offset if all buffer strings were concatenated end to end. This value is
+ *      only set when the entry exists and entry_offset lies within it.
+ * @return the struct aesd_buffer_entry structure at entry_index, or NULL if there is no such entry or
+ * entry_offset is beyond its size. This is the inverse of aesd_circular_buffer_find_entry_offset_for_fpos
+ * and takes constant time.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_fpos_for_entry_offset(struct aesd_circular_buffer *buffer,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn)
+{
+    __u8 idx;
+    if (entry_index >= aesd_circular_buffer_entry_count(buffer))
+        return NULL;
+    idx = (buffer->out_offs + entry_index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (entry_offset >= buffer->entry[idx].size)
+        return NULL;
+    *char_offset_rtn = buffer->entry_start[idx] - buffer->entry_start[buffer->out_offs] + entry_offset;
+    return &(buffer->entry[idx]);
+}
+
+/**
+ * @return the number of entries currently held in @param buffer
+ */
+unsigned int aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs)
+        % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * @return the number of bytes held in @param buffer if all the entries were
+ * concatenated end to end
+ */
+size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    if (aesd_circular_buffer_entry_count(buffer) == 0)
+        return 0;
+    return buffer->bytes_added - buffer->entry_start[buffer->out_offs];
+}
+
 static void __aesd_circular_buffer_maybe_free_entry_for_replace(struct aesd_circular_buffer *buffer, __u8 idx)
 {
     /* If there was no entry to begin with, then don't worry */
@@ -54,12 +104,13 @@ static void __aesd_circular_buffer_maybe_free_entry_for_replace(struct aesd_circ
     
     /*
      * Userspace and kernel use different dynamic memory allocation
-     * routines. Hence, all these things
+     * routines. Hence, all these things. In the kernel, the entries
+     * come from the size classed caches in aesd-entry-alloc.c
      */
 #ifdef __KERNEL__
-    kfree(buffer->entry[idx].buffptr);
+    aesd_entry_free(buffer->entry[idx].buffptr);
 #else
-    free(buffer->entry[idx].buffptr);
+    free((void *)buffer->entry[idx].buffptr);
 #endif
 }
 
@@ -85,6 +136,8 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
 
     buffer->entry[idx].size = add_entry->size;
     buffer->entry[idx].buffptr = add_entry->buffptr;
+    buffer->entry_start[idx] = buffer->bytes_added;
+    buffer->bytes_added += add_entry->size;
     buffer->in_offs = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
     if (buffer->full) {
         buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
@@ -115,4 +168,163 @@ void aesd_circular_buffer_destroy(struct aesd_circular_buffer *buffer)
         __aesd_circular_buffer_maybe_free_entry_for_replace(buffer, idx);
         idx++;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Initializes @param ring to an empty ring storing its entries in @param arena,
+ * which is @param arena_size bytes long. @param arena_size must be a power of two.
+ * The arena stays owned by the caller and must outlive the ring.
+ */
+void aesd_byte_ring_init(struct aesd_byte_ring *ring, char *arena, size_t arena_size)
+{
+    memset(ring, 0, sizeof(struct aesd_byte_ring));
+    ring->arena = arena;
+    ring->arena_size = arena_size;
+}
+
+/**
+ * Drops all the entries of @param ring. The arena is kept.
+ */
+void aesd_byte_ring_reset(struct aesd_byte_ring *ring)
+{
+    aesd_byte_ring_init(ring, ring->arena, ring->arena_size);
+}
+
+/**
+ * @return the number of entries currently held in @param ring
+ */
+unsigned int aesd_byte_ring_entry_count(const struct aesd_byte_ring *ring)
+{
+    if (ring->full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (ring->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - ring->out_offs)
+        % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * @return the number of bytes held in @param ring if all the entries were
+ * concatenated end to end
+ */
+size_t aesd_byte_ring_size(const struct aesd_byte_ring *ring)
+{
+    return ring->tail - ring->head;
+}
+
+static void __aesd_byte_ring_evict_oldest(struct aesd_byte_ring *ring)
+{
+    ring->out_offs = (ring->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    ring->full = 0;
+    if (ring->out_offs == ring->in_offs)
+        ring->head = ring->tail;
+    else
+        ring->head = ring->desc[ring->out_offs].start;
+}
+
+/**
+ * Copies @param len bytes at @param src into the arena of @param ring at the
+ * running offset @param offs, wrapping around the end of the arena if needed
+ */
+static void __aesd_byte_ring_copy_in(struct aesd_byte_ring *ring, size_t offs,
+            const char *src, size_t len)
+{
+    size_t pos = offs & (ring->arena_size - 1);
+    size_t first = ring->arena_size - pos;
+
+    if (first > len)
+        first = len;
+    memcpy(ring->arena + pos, src, first);
+    if (len > first)
+        memcpy(ring->arena, src + first, len - first);
+}
+
+/**
+ * Adds a new entry to @param ring made of the @param nparts buffers described by
+ * @param parts, concatenated. The bytes are copied, so the caller keeps ownership
+ * of them. The oldest entries are evicted while there is no free descriptor or not
+ * enough room in the arena, and their total size is stored in @param evicted_bytes_rtn.
+ *
+ * Any necessary locking must be handled by the caller
+ * @return the number of entries evicted, or -1 if the entry is larger than the arena
+ */
+long aesd_byte_ring_add_entry(struct aesd_byte_ring *ring, const struct aesd_buffer_entry *parts,
+            unsigned int nparts, size_t *evicted_bytes_rtn)
+{
+    size_t total = 0, offs;
+    long evicted = 0;
+    unsigned int i;
+
+    *evicted_bytes_rtn = 0;
+    for (i = 0; i < nparts; i++)
+        total += parts[i].size;
+    if (total > ring->arena_size)
+        return -1;
+
+    while (ring->full || aesd_byte_ring_size(ring) + total > ring->arena_size) {
+        *evicted_bytes_rtn += ring->desc[ring->out_offs].size;
+        __aesd_byte_ring_evict_oldest(ring);
+        evicted++;
+    }
+
+    offs = ring->tail;
+    for (i = 0; i < nparts; i++) {
+        __aesd_byte_ring_copy_in(ring, offs, parts[i].buffptr, parts[i].size);
+        offs += parts[i].size;
+    }
+
+    ring->desc[ring->in_offs].start = ring->tail;
+    ring->desc[ring->in_offs].size = total;
+    ring->tail += total;
+    ring->in_offs = (ring->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (ring->in_offs == ring->out_offs)
+        ring->full = 1;
+    return evicted;
+}
+
+/**
+ * Finds where the @param count bytes starting at @param char_offset of the
+ * concatenated stream live in the arena of @param ring. Fewer bytes are
+ * described if the stream ends before.
+ * @return the number of spans filled in, zero if @param char_offset is beyond
+ * the stream, two if the range wraps around the end of the arena
+ */
+unsigned int aesd_byte_ring_find_spans_for_fpos(struct aesd_byte_ring *ring, size_t char_offset,
+            size_t count, struct aesd_buffer_entry spans[2])
+{
+    size_t size = aesd_byte_ring_size(ring);
+    size_t pos, first;
+
+    if (char_offset >= size || count == 0)
+        return 0;
+    if (count > size - char_offset)
+        count = size - char_offset;
+
+    pos = (ring->head + char_offset) & (ring->arena_size - 1);
+    first = ring->arena_size - pos;
+    if (first >= count) {
+        spans[0].buffptr = ring->arena + pos;
+        spans[0].size = count;
+        return 1;
+    }
+    spans[0].buffptr = ring->arena + pos;
+    spans[0].size = first;
+    spans[1].buffptr = ring->arena;
+    spans[1].size = count - first;
+    return 2;
+}
+
+/**
+ * Same as aesd_circular_buffer_find_fpos_for_entry_offset() for @param ring
+ * @return false if there is no such entry or @param entry_offset is beyond its size
+ */
+bool aesd_byte_ring_find_fpos_for_entry_offset(struct aesd_byte_ring *ring,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn)
+{
+    __u8 idx;
+    if (entry_index >= aesd_byte_ring_entry_count(ring))
+        return false;
+    idx = (ring->out_offs + entry_index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (entry_offset >= ring->desc[idx].size)
+        return false;
+    *char_offset_rtn = ring->desc[idx].start - ring->head + entry_offset;
+    return true;
+}
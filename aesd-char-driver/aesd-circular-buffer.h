@@ -7,9 +7,16 @@
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <linux/types.h> // __u8
 #endif
 
+/**
+ * Can be overridden at build time, e.g. to benchmark other ring sizes.
+ * The offsets are __u8, so it must not exceed 255.
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
 
 struct aesd_buffer_entry
 {
@@ -29,6 +36,16 @@ struct aesd_circular_buffer
      * An array of pointers to memory allocated for the most recent write operations
      */
     struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * The value of bytes_added at the time each entry was added. The difference
+     * between two of these is the number of bytes in between, which makes offset
+     * lookups by entry index and the total size constant time.
+     */
+    size_t entry_start[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Running count of the bytes added since the buffer was initialized
+     */
+    size_t bytes_added;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
@@ -47,6 +64,13 @@ struct aesd_circular_buffer
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_fpos_for_entry_offset(struct aesd_circular_buffer *buffer,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn);
+
+extern size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer);
+
+extern unsigned int aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
@@ -54,6 +78,72 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 extern void aesd_circular_buffer_destroy(struct aesd_circular_buffer *buffer);
 
 
+/**
+ * Describes where an entry of a struct aesd_byte_ring lives in its arena
+ */
+struct aesd_byte_ring_desc
+{
+    /**
+     * Running offset of the first byte of the entry
+     */
+    size_t start;
+    /**
+     * Number of bytes in the entry
+     */
+    size_t size;
+};
+
+/**
+ * Alternative to struct aesd_circular_buffer which copies the entries into
+ * one contiguous arena instead of holding on to separately allocated buffers.
+ * The entries are laid out back to back in the order they were added, so
+ * the concatenated stream is contiguous apart from wrapping around the end of
+ * the arena and reading any range of it takes at most two copies. Evicting
+ * an entry only moves offsets, nothing is freed.
+ *
+ * Offsets are running byte counts since the ring was initialized. The arena
+ * size is a power of two so that they map to arena positions with a mask,
+ * even when they wrap around.
+ */
+struct aesd_byte_ring
+{
+    /**
+     * Storage for the entries, arena_size bytes long. It is owned by the caller
+     */
+    char *arena;
+    size_t arena_size;
+    /**
+     * Running offsets of the first byte of the oldest entry and one past
+     * the last byte of the newest entry
+     */
+    size_t head;
+    size_t tail;
+    /**
+     * Descriptors of the entries, used the same way as entry in struct aesd_circular_buffer
+     */
+    struct aesd_byte_ring_desc desc[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    __u8 in_offs;
+    __u8 out_offs;
+    __u8 full;
+};
+
+extern void aesd_byte_ring_init(struct aesd_byte_ring *ring, char *arena, size_t arena_size);
+
+extern void aesd_byte_ring_reset(struct aesd_byte_ring *ring);
+
+extern long aesd_byte_ring_add_entry(struct aesd_byte_ring *ring, const struct aesd_buffer_entry *parts,
+            unsigned int nparts, size_t *evicted_bytes_rtn);
+
+extern unsigned int aesd_byte_ring_find_spans_for_fpos(struct aesd_byte_ring *ring, size_t char_offset,
+            size_t count, struct aesd_buffer_entry spans[2]);
+
+extern bool aesd_byte_ring_find_fpos_for_entry_offset(struct aesd_byte_ring *ring,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn);
+
+extern size_t aesd_byte_ring_size(const struct aesd_byte_ring *ring);
+
+extern unsigned int aesd_byte_ring_entry_count(const struct aesd_byte_ring *ring);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
@@ -0,0 +1,144 @@
+/**
+ * @file aesd-debugfs.c
+ * @brief debugfs statistics of the AESD char driver
+ *
+ * Every device gets a directory /sys/kernel/debug/aesdchar/<minor> with
+ * - stats: bytes in and out, evictions, current entries and bytes and
+ *   the number of times the device mutex was contended
+ * - read_latency: histogram of the time spent in read
+ *
+ * Reads are only timed once 1 is written to
+ * /sys/kernel/debug/aesdchar/read_latency_enabled.
+ *
+ * @author Suchith.J.N
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/cdev.h>
+
+#include "aesdchar.h"
+
+static struct dentry *aesd_debugfs_root;
+
+DEFINE_STATIC_KEY_FALSE(aesd_read_latency_key);
+
+/**
+ * Sums the per-CPU counters of @param dev into @param total
+ */
+static void aesd_stats_sum(struct aesd_dev *dev, struct aesd_stats *total)
+{
+    int cpu, i;
+
+    memset(total, 0, sizeof(*total));
+    for_each_possible_cpu(cpu) {
+        struct aesd_stats *stats = per_cpu_ptr(dev->stats, cpu);
+        total->bytes_in += stats->bytes_in;
+        total->bytes_out += stats->bytes_out;
+        total->evictions += stats->evictions;
+        total->lock_contended += stats->lock_contended;
+        for (i = 0; i < AESD_LAT_HIST_BUCKETS; i++)
+            total->read_latency_ns[i] += stats->read_latency_ns[i];
+    }
+}
+
+static int aesd_stats_show(struct seq_file *s, void *unused)
+{
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats total;
+    unsigned int entries;
+    size_t bytes;
+
+    aesd_stats_sum(dev, &total);
+
+    if (dev->percpu.rings != NULL) {
+        bytes = aesd_percpu_rings_size(&dev->percpu, &entries);
+    } else {
+        if (mutex_lock_interruptible(&dev->lock))
+            return -ERESTARTSYS;
+        if (dev->arena.arena != NULL) {
+            bytes = aesd_byte_ring_size(&dev->arena);
+            entries = aesd_byte_ring_entry_count(&dev->arena);
+        } else {
+            bytes = aesd_circular_buffer_size(&dev->buf);
+            entries = aesd_circular_buffer_entry_count(&dev->buf);
+        }
+        mutex_unlock(&dev->lock);
+    }
+
+    seq_printf(s, "bytes_in: %llu\n", total.bytes_in);
+    seq_printf(s, "bytes_out: %llu\n", total.bytes_out);
+    seq_printf(s, "evictions: %llu\n", total.evictions);
+    seq_printf(s, "entries: %u\n", entries);
+    seq_printf(s, "bytes: %zu\n", bytes);
+    seq_printf(s, "lock_contended: %llu\n", total.lock_contended);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+static int aesd_read_latency_show(struct seq_file *s, void *unused)
+{
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats total;
+    int i;
+
+    aesd_stats_sum(dev, &total);
+    for (i = 0; i < AESD_LAT_HIST_BUCKETS - 1; i++) {
+        if (total.read_latency_ns[i] > 0)
+            seq_printf(s, "< %llu ns: %llu\n", 1ULL << i, total.read_latency_ns[i]);
+    }
+    if (total.read_latency_ns[i] > 0)
+        seq_printf(s, ">= %llu ns: %llu\n", 1ULL << (i - 1), total.read_latency_ns[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_read_latency);
+
+static int aesd_read_latency_enabled_get(void *data, u64 *val)
+{
+    *val = static_key_enabled(&aesd_read_latency_key);
+    return 0;
+}
+
+static int aesd_read_latency_enabled_set(void *data, u64 val)
+{
+    if (val)
+        static_branch_enable(&aesd_read_latency_key);
+    else
+        static_branch_disable(&aesd_read_latency_key);
+    return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(aesd_read_latency_enabled_fops, aesd_read_latency_enabled_get,
+    aesd_read_latency_enabled_set, "%llu\n");
+
+/**
+ * Failures are not fatal here. The driver works the same without debugfs.
+ */
+void aesd_debugfs_init(void)
+{
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+    debugfs_create_file_unsafe("read_latency_enabled", 0644, aesd_debugfs_root, NULL,
+        &aesd_read_latency_enabled_fops);
+}
+
+void aesd_debugfs_add_dev(struct aesd_dev *dev)
+{
+    char name[16];
+
+    snprintf(name, sizeof(name), "%u", dev->minor);
+    dev->debugfs_dir = debugfs_create_dir(name, aesd_debugfs_root);
+    debugfs_create_file("stats", 0444, dev->debugfs_dir, dev, &aesd_stats_fops);
+    debugfs_create_file("read_latency", 0444, dev->debugfs_dir, dev, &aesd_read_latency_fops);
+}
+
+/**
+ * Removes all the files. Once it returns, none of them is in use.
+ */
+void aesd_debugfs_destroy(void)
+{
+    debugfs_remove_recursive(aesd_debugfs_root);
+    aesd_debugfs_root = NULL;
+}
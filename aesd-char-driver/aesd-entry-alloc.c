@@ -0,0 +1,108 @@
+/**
+ * @file aesd-entry-alloc.c
+ * @brief Size classed slab allocation for the AESD char driver entries
+ *
+ * @author Suchith.J.N
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+
+#include "aesd-entry-alloc.h"
+
+/**
+ * Smallest size class in bytes (including the header) and the number of
+ * size classes. Each class doubles the previous one, so with 64 and 7
+ * classes, commands of up to 4KiB minus the header come from a cache.
+ */
+#define AESD_ENTRY_MIN_CLASS_SIZE   64
+#define AESD_ENTRY_NR_CLASSES       7
+
+/* Marks an entry that did not fit any of the caches */
+#define AESD_ENTRY_CLASS_LARGE      AESD_ENTRY_NR_CLASSES
+
+struct aesd_entry_hdr
+{
+    /**
+     * Index of the cache this entry was allocated from or
+     * AESD_ENTRY_CLASS_LARGE for kvmalloc() allocations
+     */
+    unsigned long size_class;
+    char data[];
+};
+
+static struct kmem_cache *aesd_entry_caches[AESD_ENTRY_NR_CLASSES];
+static char aesd_entry_cache_names[AESD_ENTRY_NR_CLASSES][24];
+
+static inline size_t __aesd_entry_class_size(unsigned int size_class)
+{
+    return (size_t)AESD_ENTRY_MIN_CLASS_SIZE << size_class;
+}
+
+int aesd_entry_alloc_init(void)
+{
+    unsigned int i;
+    for (i = 0; i < AESD_ENTRY_NR_CLASSES; i++) {
+        size_t class_size = __aesd_entry_class_size(i);
+        snprintf(aesd_entry_cache_names[i], sizeof(aesd_entry_cache_names[i]),
+            "aesd_entry_%zu", class_size);
+        aesd_entry_caches[i] = kmem_cache_create(aesd_entry_cache_names[i],
+            class_size, 0, 0, NULL);
+        if (aesd_entry_caches[i] == NULL) {
+            aesd_entry_alloc_destroy();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Destroys the caches. All the entries must have been freed by now,
+ * otherwise the slab allocator complains about the leaked objects.
+ */
+void aesd_entry_alloc_destroy(void)
+{
+    unsigned int i;
+    for (i = 0; i < AESD_ENTRY_NR_CLASSES; i++) {
+        kmem_cache_destroy(aesd_entry_caches[i]);
+        aesd_entry_caches[i] = NULL;
+    }
+}
+
+char *aesd_entry_alloc(size_t size)
+{
+    struct aesd_entry_hdr *hdr;
+    size_t total = sizeof(*hdr) + size;
+    unsigned int size_class = 0;
+
+    while (size_class < AESD_ENTRY_NR_CLASSES &&
+            __aesd_entry_class_size(size_class) < total)
+        size_class++;
+
+    if (size_class < AESD_ENTRY_NR_CLASSES)
+        hdr = kmem_cache_alloc(aesd_entry_caches[size_class], GFP_KERNEL);
+    else
+        hdr = kvmalloc(total, GFP_KERNEL);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->size_class = size_class;
+    return hdr->data;
+}
+
+void aesd_entry_free(const char *buffptr)
+{
+    struct aesd_entry_hdr *hdr;
+
+    if (buffptr == NULL)
+        return;
+
+    hdr = (struct aesd_entry_hdr *)(buffptr - offsetof(struct aesd_entry_hdr, data));
+    if (hdr->size_class < AESD_ENTRY_NR_CLASSES)
+        kmem_cache_free(aesd_entry_caches[hdr->size_class], hdr);
+    else
+        kvfree(hdr);
+}
@@ -0,0 +1,29 @@
+#ifndef AESD_ENTRY_ALLOC_H
+#define AESD_ENTRY_ALLOC_H
+
+#include <linux/types.h>
+
+/**
+ * Circular buffer entries are allocated from a small set of slab caches
+ * sized in powers of two. Each allocation carries a one word header in
+ * front of the command bytes recording the cache it came from, so that
+ * the entry can be released knowing nothing but its buffptr. Commands
+ * larger than the largest size class fall back to kvmalloc().
+ */
+extern int aesd_entry_alloc_init(void);
+
+extern void aesd_entry_alloc_destroy(void);
+
+/**
+ * @return a buffer of at least @param size bytes for the contents of a
+ * circular buffer entry, or NULL if the allocation failed. It must be
+ * released with aesd_entry_free(). May sleep.
+ */
+extern char *aesd_entry_alloc(size_t size);
+
+/**
+ * Releases a buffer returned by aesd_entry_alloc(). NULL is ignored.
+ */
+extern void aesd_entry_free(const char *buffptr);
+
+#endif /* AESD_ENTRY_ALLOC_H */
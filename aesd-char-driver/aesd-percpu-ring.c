@@ -0,0 +1,272 @@
+/**
+ * @file aesd-percpu-ring.c
+ * @brief Per-CPU circular buffers merged in sequence order on read
+ *
+ * @author Suchith.J.N
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/smp.h>
+
+#include "aesd-percpu-ring.h"
+#include "aesd-entry-alloc.h"
+
+/**
+ * Upper bound on the bytes copied out by a single read. The bytes are
+ * gathered under the ring locks, so they go through a bounce buffer.
+ */
+#define AESD_PERCPU_READ_CHUNK  (64 * 1024)
+
+/**
+ * Position of an entry in the merged stream
+ */
+struct aesd_percpu_snapshot_entry
+{
+    u64 seq;
+    size_t size;
+    int cpu;
+};
+
+int aesd_percpu_rings_init(struct aesd_percpu_rings *rings)
+{
+    int cpu;
+
+    rings->rings = alloc_percpu(struct aesd_percpu_ring);
+    if (rings->rings == NULL)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        struct aesd_percpu_ring *ring = per_cpu_ptr(rings->rings, cpu);
+        spin_lock_init(&ring->lock);
+        aesd_circular_buffer_init(&ring->buf);
+    }
+    atomic64_set(&rings->next_seq, 0);
+    return 0;
+}
+
+void aesd_percpu_rings_destroy(struct aesd_percpu_rings *rings)
+{
+    if (rings->rings == NULL)
+        return;
+    aesd_percpu_rings_trim(rings);
+    free_percpu(rings->rings);
+    rings->rings = NULL;
+}
+
+/**
+ * Empties all the rings. The entries are detached under the lock and
+ * freed after dropping it since freeing a large entry may sleep.
+ */
+void aesd_percpu_rings_trim(struct aesd_percpu_rings *rings)
+{
+    struct aesd_circular_buffer old;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct aesd_percpu_ring *ring = per_cpu_ptr(rings->rings, cpu);
+        spin_lock(&ring->lock);
+        old = ring->buf;
+        aesd_circular_buffer_init(&ring->buf);
+        spin_unlock(&ring->lock);
+        aesd_circular_buffer_destroy(&old);
+    }
+}
+
+/**
+ * Adds @param add_entry to the ring of the current CPU. Only the lock of
+ * that ring is taken, which also keeps the writer on the CPU.
+ * @return true if the oldest entry of that ring was evicted, in which case its
+ * size is stored in @param evicted_size_rtn
+ */
+bool aesd_percpu_rings_add_entry(struct aesd_percpu_rings *rings,
+            const struct aesd_buffer_entry *add_entry, size_t *evicted_size_rtn)
+{
+    struct aesd_percpu_ring *ring;
+    const char *evicted = NULL;
+    bool full;
+
+    ring = get_cpu_ptr(rings->rings);
+    spin_lock(&ring->lock);
+    full = ring->buf.full;
+    if (full) {
+        /**
+         * Take the oldest entry out so that the circular buffer does not
+         * free it under the spinlock. It is freed once the lock is dropped.
+         */
+        evicted = ring->buf.entry[ring->buf.in_offs].buffptr;
+        *evicted_size_rtn = ring->buf.entry[ring->buf.in_offs].size;
+        ring->buf.entry[ring->buf.in_offs].buffptr = NULL;
+    }
+    /**
+     * The sequence number is taken under the lock so that the entries of
+     * a ring are always in sequence order.
+     */
+    ring->seq[ring->buf.in_offs] = atomic64_inc_return(&rings->next_seq);
+    aesd_circular_buffer_add_entry(&ring->buf, add_entry);
+    spin_unlock(&ring->lock);
+    put_cpu_ptr(rings->rings);
+
+    aesd_entry_free(evicted);
+    return full;
+}
+
+/**
+ * Fills @param snap with the AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED most
+ * recent entries across all the rings, oldest first.
+ * @return the number of entries in @param snap
+ */
+static unsigned int __aesd_percpu_rings_snapshot(struct aesd_percpu_rings *rings,
+            struct aesd_percpu_snapshot_entry *snap)
+{
+    unsigned int nr = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct aesd_percpu_ring *ring = per_cpu_ptr(rings->rings, cpu);
+        struct aesd_buffer_entry *entry;
+        __u8 idx;
+
+        spin_lock(&ring->lock);
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring->buf, idx) {
+            struct aesd_percpu_snapshot_entry cur = {
+                .seq = ring->seq[idx], .size = entry->size, .cpu = cpu,
+            };
+            unsigned int pos;
+
+            if (entry->buffptr == NULL)
+                continue;
+            /* Keep only the newest entries, sorted by insertion */
+            if (nr == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+                if (cur.seq < snap[0].seq)
+                    continue;
+                memmove(&snap[0], &snap[1], (nr - 1) * sizeof(*snap));
+                nr--;
+            }
+            pos = nr;
+            while (pos > 0 && snap[pos - 1].seq > cur.seq) {
+                snap[pos] = snap[pos - 1];
+                pos--;
+            }
+            snap[pos] = cur;
+            nr++;
+        }
+        spin_unlock(&ring->lock);
+    }
+    return nr;
+}
+
+/**
+ * Copies up to @param len bytes starting at @param offset of the entry
+ * described by @param snap into @param dst.
+ * @return false if the entry was evicted since the snapshot was taken
+ */
+static bool __aesd_percpu_rings_copy_entry(struct aesd_percpu_rings *rings,
+            const struct aesd_percpu_snapshot_entry *snap, size_t offset,
+            char *dst, size_t len)
+{
+    struct aesd_percpu_ring *ring = per_cpu_ptr(rings->rings, snap->cpu);
+    bool found = false;
+    __u8 idx;
+
+    spin_lock(&ring->lock);
+    for (idx = 0; idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; idx++) {
+        if (ring->buf.entry[idx].buffptr != NULL && ring->seq[idx] == snap->seq) {
+            memcpy(dst, ring->buf.entry[idx].buffptr + offset, len);
+            found = true;
+            break;
+        }
+    }
+    spin_unlock(&ring->lock);
+    return found;
+}
+
+/**
+ * Reads the merged stream at @param pos into @param to and advances @param pos.
+ * Entries evicted while reading end the read early, like a short read.
+ */
+ssize_t aesd_percpu_rings_read(struct aesd_percpu_rings *rings, loff_t *pos,
+            struct iov_iter *to)
+{
+    struct aesd_percpu_snapshot_entry snap[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t count = min_t(size_t, iov_iter_count(to), AESD_PERCPU_READ_CHUNK);
+    size_t seen_so_far = 0, gathered = 0, copied;
+    unsigned int nr, i;
+    char *bounce;
+
+    nr = __aesd_percpu_rings_snapshot(rings, snap);
+    for (i = 0; i < nr; i++)
+        seen_so_far += snap[i].size;
+    if (*pos >= seen_so_far || count == 0)
+        return 0;
+    count = min_t(size_t, count, seen_so_far - *pos);
+
+    bounce = kvmalloc(count, GFP_KERNEL);
+    if (bounce == NULL)
+        return -ENOMEM;
+
+    seen_so_far = 0;
+    for (i = 0; i < nr && gathered < count; i++) {
+        size_t start = *pos + gathered;
+        size_t entry_offset, len;
+
+        if (start >= seen_so_far + snap[i].size) {
+            seen_so_far += snap[i].size;
+            continue;
+        }
+        entry_offset = start - seen_so_far;
+        len = min_t(size_t, snap[i].size - entry_offset, count - gathered);
+        if (!__aesd_percpu_rings_copy_entry(rings, &snap[i], entry_offset,
+                bounce + gathered, len))
+            break;
+        gathered += len;
+        seen_so_far += snap[i].size;
+    }
+
+    copied = copy_to_iter(bounce, gathered, to);
+    kvfree(bounce);
+    if (copied == 0 && gathered > 0)
+        return -EFAULT;
+    *pos += copied;
+    return copied;
+}
+
+/**
+ * @return the number of bytes in the merged stream. The number of entries
+ * is stored in @param entry_count_rtn unless it is NULL.
+ */
+size_t aesd_percpu_rings_size(struct aesd_percpu_rings *rings, unsigned int *entry_count_rtn)
+{
+    struct aesd_percpu_snapshot_entry snap[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int nr, i;
+    size_t size = 0;
+
+    nr = __aesd_percpu_rings_snapshot(rings, snap);
+    for (i = 0; i < nr; i++)
+        size += snap[i].size;
+    if (entry_count_rtn != NULL)
+        *entry_count_rtn = nr;
+    return size;
+}
+
+/**
+ * Same as aesd_circular_buffer_find_fpos_for_entry_offset() for the merged stream
+ * @return false if there is no such entry or @param entry_offset is beyond its size
+ */
+bool aesd_percpu_rings_find_fpos_for_entry_offset(struct aesd_percpu_rings *rings,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn)
+{
+    struct aesd_percpu_snapshot_entry snap[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int nr, i;
+    size_t fpos = 0;
+
+    nr = __aesd_percpu_rings_snapshot(rings, snap);
+    if (entry_index >= nr || entry_offset >= snap[entry_index].size)
+        return false;
+    for (i = 0; i < entry_index; i++)
+        fpos += snap[i].size;
+    *char_offset_rtn = fpos + entry_offset;
+    return true;
+}
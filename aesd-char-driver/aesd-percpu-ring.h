@@ -0,0 +1,56 @@
+#ifndef AESD_PERCPU_RING_H
+#define AESD_PERCPU_RING_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/uio.h>
+
+#include "aesd-circular-buffer.h"
+
+/**
+ * A circular buffer owned by one CPU. Writers only ever touch the ring of
+ * the CPU they run on, so the lock is uncontended unless a reader is
+ * walking the rings at the same time.
+ */
+struct aesd_percpu_ring
+{
+    spinlock_t lock;
+    struct aesd_circular_buffer buf;
+    /**
+     * Global sequence number of the entry in the same slot of buf
+     */
+    u64 seq[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+/**
+ * A set of per-CPU rings presenting the same byte stream as a single
+ * struct aesd_circular_buffer: the AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ * most recent entries across all CPUs, oldest first, ordered by the
+ * sequence number assigned when each entry was added.
+ */
+struct aesd_percpu_rings
+{
+    struct aesd_percpu_ring __percpu *rings;
+    atomic64_t next_seq;
+};
+
+extern int aesd_percpu_rings_init(struct aesd_percpu_rings *rings);
+
+extern void aesd_percpu_rings_destroy(struct aesd_percpu_rings *rings);
+
+extern void aesd_percpu_rings_trim(struct aesd_percpu_rings *rings);
+
+extern bool aesd_percpu_rings_add_entry(struct aesd_percpu_rings *rings,
+            const struct aesd_buffer_entry *add_entry, size_t *evicted_size_rtn);
+
+extern ssize_t aesd_percpu_rings_read(struct aesd_percpu_rings *rings, loff_t *pos,
+            struct iov_iter *to);
+
+extern size_t aesd_percpu_rings_size(struct aesd_percpu_rings *rings, unsigned int *entry_count_rtn);
+
+extern bool aesd_percpu_rings_find_fpos_for_entry_offset(struct aesd_percpu_rings *rings,
+            unsigned int entry_index, size_t entry_offset, size_t *char_offset_rtn);
+
+#endif /* AESD_PERCPU_RING_H */
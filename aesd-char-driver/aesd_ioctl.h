@@ -0,0 +1,98 @@
+/*
+ * aesd_ioctl.h
+ *
+ *  @brief Definitions for the ioctls used on aesd char devices
+ */
+
+#ifndef AESD_IOCTL_H
+#define AESD_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <stdint.h>
+#endif
+
+/**
+ * A single command of a AESDCHAR_IOCWRITEV batch
+ */
+struct aesd_write_cmd {
+    /**
+     * Userspace address of the command bytes
+     */
+    uint64_t buf;
+    /**
+     * Number of bytes at buf
+     */
+    uint64_t len;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, describing
+ * a batch of commands to be added to the circular buffer under a single lock
+ * acquisition. The bytes are processed exactly as if they were written back to
+ * back with write(), so a command without a newline is joined with the next one.
+ */
+struct aesd_write_batch {
+    /**
+     * Userspace address of an array of struct aesd_write_cmd for AESDCHAR_IOCWRITEV
+     * or of newline delimited command bytes for AESDCHAR_IOCWRITEBLOB
+     */
+    uint64_t data;
+    /**
+     * Number of elements (AESDCHAR_IOCWRITEV) or bytes (AESDCHAR_IOCWRITEBLOB) at data
+     */
+    uint64_t count;
+    /**
+     * Filled in by the driver: number of entries added to the circular buffer
+     */
+    uint32_t accepted;
+    /**
+     * Filled in by the driver: number of older entries evicted to make room
+     */
+    uint32_t evicted;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, describing the type
+ * of seek performed on the aesdchar driver
+ */
+struct aesd_seekto {
+    /**
+     * The zero referenced write command to seek into, counting from the oldest entry
+     */
+    uint32_t write_cmd;
+    /**
+     * The zero referenced offset within the write
+     */
+    uint32_t write_cmd_offset;
+};
+
+/**
+ * Limits on a single batch. Larger batches are rejected with E2BIG.
+ */
+#define AESDCHAR_BATCH_MAX_CMDS     1024
+#define AESDCHAR_BATCH_MAX_BYTES    (1024 * 1024)
+
+// Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
+#define AESD_IOC_MAGIC 0x16
+
+/**
+ * Batched writes. On success the ioctl returns the number of bytes consumed,
+ * which is less than the batch size only if the driver ran out of memory midway.
+ */
+#define AESDCHAR_IOCWRITEV      _IOWR(AESD_IOC_MAGIC, 1, struct aesd_write_batch)
+#define AESDCHAR_IOCWRITEBLOB   _IOWR(AESD_IOC_MAGIC, 2, struct aesd_write_batch)
+/**
+ * Moves the file position to the given offset within the given entry. Fails with
+ * EINVAL if the entry does not exist or the offset is beyond its size.
+ */
+#define AESDCHAR_IOCSEEKTO      _IOWR(AESD_IOC_MAGIC, 3, struct aesd_seekto)
+/**
+ * The maximum number of commands supported, used for bounds checking
+ */
+#define AESDCHAR_IOC_MAXNR 3
+
+#endif /* AESD_IOCTL_H */
@@ -1,11 +1,15 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
+#include <linux/cache.h>
+#include <linux/jump_label.h>
 #include <linux/mutex.h>
+#include <linux/types.h>
 
 #include "aesd-circular-buffer.h"
+#include "aesd-percpu-ring.h"
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -20,11 +24,60 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Bytes written without a terminating newline. They are held here until
+ * a newline arrives, at which point pending bytes and the new bytes up to
+ * the newline are committed as a single circular buffer entry.
+ */
+struct aesd_pending_cmd
+{
+     char *buffptr;
+     size_t size;
+     size_t capacity;
+};
+
+struct dentry;
+
+/**
+ * Read latencies are counted in buckets of powers of two nanoseconds.
+ * Bucket i holds the reads that took less than 2^i ns, the last one
+ * everything slower. Reads are only timed while aesd_read_latency_key is
+ * on, which it is not by default, so that reads cost nothing extra
+ * otherwise.
+ */
+#define AESD_LAT_HIST_BUCKETS 32
+
+/**
+ * Counters of a device. They are kept per CPU so that updating them does
+ * not bounce a cache line between writers and are summed up when they
+ * are shown through debugfs.
+ */
+struct aesd_stats
+{
+     u64 bytes_in;
+     u64 bytes_out;
+     u64 evictions;
+     u64 lock_contended;
+     u64 read_latency_ns[AESD_LAT_HIST_BUCKETS];
+};
+
 struct aesd_dev
 {
      struct mutex lock;
      struct aesd_circular_buffer buf;
+     struct aesd_pending_cmd pending; /* Protected by lock */
+     struct aesd_percpu_rings percpu; /* Used instead of buf if percpu.rings is set */
+     struct aesd_byte_ring arena; /* Used instead of buf if arena.arena is set, protected by lock */
      struct cdev cdev;     /* Char device structure      */
-};
+     unsigned int minor;
+     struct aesd_stats __percpu *stats;
+     struct dentry *debugfs_dir;
+} ____cacheline_aligned_in_smp; /* Devices sit next to each other in an array */
+
+/* aesd-debugfs.c */
+DECLARE_STATIC_KEY_FALSE(aesd_read_latency_key);
+extern void aesd_debugfs_init(void);
+extern void aesd_debugfs_add_dev(struct aesd_dev *dev);
+extern void aesd_debugfs_destroy(void);
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -0,0 +1,85 @@
+/**
+ * Tracepoints for the AESD char driver. They are compiled in but cost
+ * nothing until enabled, e.g. with
+ * echo 1 > /sys/kernel/tracing/events/aesdchar/enable
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesd_write,
+    TP_PROTO(unsigned int minor, size_t count, ssize_t ret, unsigned int added),
+    TP_ARGS(minor, count, ret, added),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(unsigned int, added)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->added = added;
+    ),
+    TP_printk("minor=%u count=%zu ret=%zd added=%u",
+        __entry->minor, __entry->count, __entry->ret, __entry->added)
+);
+
+TRACE_EVENT(aesd_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u pos=%lld count=%zu ret=%zd",
+        __entry->minor, __entry->pos, __entry->count, __entry->ret)
+);
+
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(unsigned int minor, size_t size),
+    TP_ARGS(minor, size),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->size = size;
+    ),
+    TP_printk("minor=%u size=%zu", __entry->minor, __entry->size)
+);
+
+TRACE_EVENT(aesd_trim,
+    TP_PROTO(unsigned int minor),
+    TP_ARGS(minor),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+    ),
+    TP_printk("minor=%u", __entry->minor)
+);
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
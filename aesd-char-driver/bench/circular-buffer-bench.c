@@ -0,0 +1,167 @@
+/**
+ * @file circular-buffer-bench.c
+ * @brief Userspace throughput benchmark of aesd-circular-buffer.c
+ *
+ * Measures aesd_circular_buffer_add_entry() and
+ * aesd_circular_buffer_find_entry_offset_for_fpos() for a few entry size
+ * distributions, and the same for the byte ring (aesd_byte_ring_add_entry()
+ * and a read of one entry's worth of bytes through
+ * aesd_byte_ring_find_spans_for_fpos()). The ring size is fixed at build time through
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, so CMake builds one binary
+ * per ring size.
+ *
+ * Usage: circular-buffer-bench-<ring size> [iterations]
+ *
+ * @author Suchith.J.N
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS 1000000
+#define ARENA_SIZE (1024 * 1024)
+#define MAX_ENTRY_SIZE 4096
+
+typedef size_t (*entry_size_fn)(unsigned int *seed);
+
+static size_t entry_size_fixed_small(unsigned int *seed)
+{
+    return 16;
+}
+
+static size_t entry_size_uniform(unsigned int *seed)
+{
+    return 1 + rand_r(seed) % 256;
+}
+
+// Mostly short commands with the occasional page sized one
+static size_t entry_size_bimodal(unsigned int *seed)
+{
+    return (rand_r(seed) % 10 == 0) ? 4096 : 32;
+}
+
+static const struct
+{
+    const char *name;
+    entry_size_fn size;
+} distributions[] = {
+    { "fixed-16", entry_size_fixed_small },
+    { "uniform-1-256", entry_size_uniform },
+    { "bimodal-32-4096", entry_size_bimodal },
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *dist, const char *op, long iterations, double elapsed_ns)
+{
+    printf("%-6d %-16s %-12s %12.0f ops/s %8.1f ns/op\n",
+        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, dist, op,
+        iterations / (elapsed_ns / 1e9), elapsed_ns / iterations);
+}
+
+static void bench_distribution(const char *name, entry_size_fn size_fn, long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    unsigned int seed = 1;
+    size_t total, entry_offset;
+    volatile size_t sink = 0;
+
+    aesd_circular_buffer_init(&buffer);
+
+    // The ring frees what it evicts, so every entry is heap allocated
+    // like in the driver. The allocation is part of the measured cost.
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        struct aesd_buffer_entry entry;
+        entry.size = size_fn(&seed);
+        entry.buffptr = malloc(entry.size);
+        if (entry.buffptr == NULL) {
+            perror("bench: malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    report(name, "add_entry", iterations, now_ns() - start);
+
+    total = aesd_circular_buffer_size(&buffer);
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        size_t fpos = (size_t)rand_r(&seed) % total;
+        struct aesd_buffer_entry *entry =
+            aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &entry_offset);
+        sink += entry->size + entry_offset;
+    }
+    report(name, "find_fpos", iterations, now_ns() - start);
+
+    aesd_circular_buffer_destroy(&buffer);
+}
+
+static void bench_byte_ring_distribution(const char *name, entry_size_fn size_fn, long iterations)
+{
+    static char src[MAX_ENTRY_SIZE], dst[MAX_ENTRY_SIZE];
+    struct aesd_byte_ring ring;
+    unsigned int seed = 1;
+    size_t total, evicted_bytes;
+    volatile size_t sink = 0;
+    char *arena = malloc(ARENA_SIZE);
+
+    if (arena == NULL) {
+        perror("bench: malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    aesd_byte_ring_init(&ring, arena, ARENA_SIZE);
+
+    // Entries are copied into the arena, there is no allocation per entry
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        struct aesd_buffer_entry part = { .buffptr = src, .size = size_fn(&seed) };
+        sink += aesd_byte_ring_add_entry(&ring, &part, 1, &evicted_bytes);
+    }
+    report(name, "arena_add", iterations, now_ns() - start);
+
+    total = aesd_byte_ring_size(&ring);
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        struct aesd_buffer_entry spans[2];
+        size_t fpos = (size_t)rand_r(&seed) % total, off = 0;
+        unsigned int nspans = aesd_byte_ring_find_spans_for_fpos(&ring, fpos,
+            size_fn(&seed), spans);
+        for (unsigned int j = 0; j < nspans; j++) {
+            memcpy(dst + off, spans[j].buffptr, spans[j].size);
+            off += spans[j].size;
+        }
+        sink += off;
+    }
+    report(name, "arena_read", iterations, now_ns() - start);
+
+    free(arena);
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = DEFAULT_ITERATIONS;
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+        if (iterations <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-6s %-16s %-12s %18s %14s\n", "ring", "distribution", "operation", "throughput", "latency");
+    for (size_t i = 0; i < sizeof(distributions) / sizeof(distributions[0]); i++) {
+        bench_distribution(distributions[i].name, distributions[i].size, iterations);
+        bench_byte_ring_distribution(distributions[i].name, distributions[i].size, iterations);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+/**
+ * @file circular-buffer-fuzz.c
+ * @brief Fuzz target checking aesd-circular-buffer.c against a reference model
+ *
+ * The input is decoded as a sequence of operations on both the circular
+ * buffer and a naive model of it (the most recent entries concatenated in
+ * a flat array). The same operations are applied to a byte ring, with its
+ * own model since it also evicts entries when its arena is full. Any
+ * disagreement aborts, which the fuzzer reports as a crash.
+ *
+ * Built with -DAESD_FUZZ_LIBFUZZER and -fsanitize=fuzzer this is a libFuzzer
+ * target. Otherwise it has its own main() which runs each file given on the
+ * command line (- for stdin, as used by AFL), or when given no input at all a fixed
+ * number of pseudo random inputs as a smoke test.
+ *
+ * @author Suchith.J.N
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aesd-circular-buffer.h"
+
+#define N AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+#define MAX_INPUT_SIZE      (64 * 1024)
+#define SMOKE_TEST_INPUTS   2000
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: model mismatch: %s\n", __FILE__, __LINE__, #cond); \
+        abort(); \
+    } \
+} while (0)
+
+/**
+ * Reference model: the sizes and contents of the entries, oldest first
+ */
+struct model
+{
+    size_t sizes[N];
+    char *data[N];
+    unsigned int count;
+};
+
+static size_t model_size(const struct model *m)
+{
+    size_t total = 0;
+    for (unsigned int i = 0; i < m->count; i++)
+        total += m->sizes[i];
+    return total;
+}
+
+/**
+ * Adds an entry, evicting the oldest ones while there are N entries or
+ * the total would exceed @param max_bytes
+ */
+static void model_add(struct model *m, const char *bytes, size_t size, size_t max_bytes)
+{
+    while (m->count == N || (m->count > 0 && model_size(m) + size > max_bytes)) {
+        free(m->data[0]);
+        memmove(&m->sizes[0], &m->sizes[1], (N - 1) * sizeof(m->sizes[0]));
+        memmove(&m->data[0], &m->data[1], (N - 1) * sizeof(m->data[0]));
+        m->count--;
+    }
+    m->data[m->count] = malloc(size);
+    memcpy(m->data[m->count], bytes, size);
+    m->sizes[m->count] = size;
+    m->count++;
+}
+
+static void model_clear(struct model *m)
+{
+    for (unsigned int i = 0; i < m->count; i++)
+        free(m->data[i]);
+    m->count = 0;
+}
+
+/**
+ * Checks the byte at @param fpos of the concatenated stream
+ */
+static void check_fpos(struct aesd_circular_buffer *buffer, const struct model *m, size_t fpos)
+{
+    size_t entry_offset = 0, seen = 0;
+    struct aesd_buffer_entry *entry =
+        aesd_circular_buffer_find_entry_offset_for_fpos(buffer, fpos, &entry_offset);
+
+    for (unsigned int i = 0; i < m->count; i++) {
+        if (fpos < seen + m->sizes[i]) {
+            check(entry != NULL);
+            check(entry->size == m->sizes[i]);
+            check(entry_offset == fpos - seen);
+            check(entry->buffptr[entry_offset] == m->data[i][fpos - seen]);
+            return;
+        }
+        seen += m->sizes[i];
+    }
+    check(entry == NULL);
+}
+
+static void check_entry_offset(struct aesd_circular_buffer *buffer, const struct model *m,
+    unsigned int entry_index, size_t entry_offset)
+{
+    size_t fpos = 0, expected = 0;
+    struct aesd_buffer_entry *entry = aesd_circular_buffer_find_fpos_for_entry_offset(buffer,
+        entry_index, entry_offset, &fpos);
+
+    if (entry_index >= m->count || entry_offset >= m->sizes[entry_index]) {
+        check(entry == NULL);
+        return;
+    }
+    for (unsigned int i = 0; i < entry_index; i++)
+        expected += m->sizes[i];
+    check(entry != NULL);
+    check(fpos == expected + entry_offset);
+    check(entry->buffptr[entry_offset] == m->data[entry_index][entry_offset]);
+}
+
+/**
+ * Checks the @param count bytes at @param fpos of the stream of @param ring
+ */
+static void check_ring_fpos(struct aesd_byte_ring *ring, const struct model *m,
+    size_t fpos, size_t count)
+{
+    struct aesd_buffer_entry spans[2];
+    size_t total = model_size(m), expected_count, seen = 0;
+    unsigned int nspans = aesd_byte_ring_find_spans_for_fpos(ring, fpos, count, spans);
+    unsigned int span = 0, i = 0;
+    size_t span_offset = 0;
+
+    if (fpos >= total || count == 0) {
+        check(nspans == 0);
+        return;
+    }
+    expected_count = count < total - fpos ? count : total - fpos;
+    check(nspans == 1 || nspans == 2);
+    check(spans[0].size + (nspans == 2 ? spans[1].size : 0) == expected_count);
+
+    // Walk the model and the spans side by side
+    for (size_t p = fpos; p < fpos + expected_count; p++) {
+        while (p >= seen + m->sizes[i])
+            seen += m->sizes[i++];
+        while (span_offset == spans[span].size) {
+            span++;
+            span_offset = 0;
+        }
+        check(spans[span].buffptr[span_offset++] == m->data[i][p - seen]);
+    }
+}
+
+static void check_ring_entry_offset(struct aesd_byte_ring *ring, const struct model *m,
+    unsigned int entry_index, size_t entry_offset)
+{
+    size_t fpos = 0, expected = 0;
+    bool found = aesd_byte_ring_find_fpos_for_entry_offset(ring, entry_index, entry_offset, &fpos);
+
+    if (entry_index >= m->count || entry_offset >= m->sizes[entry_index]) {
+        check(!found);
+        return;
+    }
+    for (unsigned int i = 0; i < entry_index; i++)
+        expected += m->sizes[i];
+    check(found);
+    check(fpos == expected + entry_offset);
+}
+
+/**
+ * Operations are encoded as one opcode byte followed by its arguments.
+ * Missing argument bytes read as zero.
+ */
+static void run_one_input(const uint8_t *input, size_t len)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_byte_ring ring;
+    struct model m = { .count = 0 }, rm = { .count = 0 };
+    size_t pos = 0;
+
+#define NEXT_BYTE() (pos < len ? input[pos++] : 0)
+
+    // Small arenas so that entries wrap around and evict each other often
+    size_t arena_size = (size_t)256 << (NEXT_BYTE() % 3);
+    char *arena = malloc(arena_size);
+
+    aesd_circular_buffer_init(&buffer);
+    aesd_byte_ring_init(&ring, arena, arena_size);
+    while (pos < len) {
+        switch (NEXT_BYTE() % 5) {
+        case 0: {
+            // Add an entry, its size and fill byte come from the input
+            struct aesd_buffer_entry entry;
+            size_t size = 1 + NEXT_BYTE();
+            char *bytes = malloc(size);
+            for (size_t i = 0; i < size; i++)
+                bytes[i] = (char)(NEXT_BYTE() + i);
+            unsigned int ring_count = rm.count;
+            model_add(&m, bytes, size, SIZE_MAX);
+            model_add(&rm, bytes, size, arena_size);
+
+            // The byte ring copies the entry, give it in two parts
+            struct aesd_buffer_entry parts[2] = {
+                { .buffptr = bytes, .size = size / 2 },
+                { .buffptr = bytes + size / 2, .size = size - size / 2 },
+            };
+            size_t evicted_bytes;
+            check(aesd_byte_ring_add_entry(&ring, parts, 2, &evicted_bytes) ==
+                ring_count + 1 - rm.count);
+
+            entry.buffptr = bytes;
+            entry.size = size;
+            aesd_circular_buffer_add_entry(&buffer, &entry);
+            break;
+        }
+        case 1: {
+            size_t fpos = ((size_t)NEXT_BYTE() << 8) | NEXT_BYTE();
+            check_fpos(&buffer, &m, fpos);
+            check_ring_fpos(&ring, &rm, fpos % (arena_size + 1), 1 + NEXT_BYTE() * 2);
+            break;
+        }
+        case 2: {
+            unsigned int entry_index = NEXT_BYTE() % (N + 2);
+            size_t entry_offset = NEXT_BYTE();
+            check_entry_offset(&buffer, &m, entry_index, entry_offset);
+            check_ring_entry_offset(&ring, &rm, entry_index, entry_offset);
+            break;
+        }
+        case 3:
+            check(aesd_circular_buffer_size(&buffer) == model_size(&m));
+            check(aesd_circular_buffer_entry_count(&buffer) == m.count);
+            check(aesd_byte_ring_size(&ring) == model_size(&rm));
+            check(aesd_byte_ring_entry_count(&ring) == rm.count);
+            break;
+        case 4:
+            aesd_circular_buffer_destroy(&buffer);
+            aesd_circular_buffer_init(&buffer);
+            model_clear(&m);
+            aesd_byte_ring_reset(&ring);
+            model_clear(&rm);
+            break;
+        }
+    }
+#undef NEXT_BYTE
+
+    // Every position of the stream and one past the end must agree
+    size_t total = model_size(&m);
+    check(aesd_circular_buffer_size(&buffer) == total);
+    for (size_t fpos = 0; fpos <= total; fpos++)
+        check_fpos(&buffer, &m, fpos);
+
+    total = model_size(&rm);
+    check(aesd_byte_ring_size(&ring) == total);
+    check_ring_fpos(&ring, &rm, 0, total + 1);
+    for (size_t fpos = 0; fpos <= total; fpos++)
+        check_ring_fpos(&ring, &rm, fpos, 1);
+
+    aesd_circular_buffer_destroy(&buffer);
+    model_clear(&m);
+    free(arena);
+    model_clear(&rm);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    run_one_input(data, size);
+    return 0;
+}
+
+#ifndef AESD_FUZZ_LIBFUZZER
+static size_t read_input(FILE *f, uint8_t *input)
+{
+    return fread(input, 1, MAX_INPUT_SIZE, f);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t input[MAX_INPUT_SIZE];
+    size_t len;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-") == 0) {
+                len = read_input(stdin, input);
+                run_one_input(input, len);
+                continue;
+            }
+            FILE *f = fopen(argv[i], "rb");
+            if (f == NULL) {
+                perror(argv[i]);
+                return EXIT_FAILURE;
+            }
+            len = read_input(f, input);
+            fclose(f);
+            run_one_input(input, len);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    unsigned int seed = 1;
+    for (int i = 0; i < SMOKE_TEST_INPUTS; i++) {
+        len = 1 + rand_r(&seed) % 4096;
+        for (size_t j = 0; j < len; j++)
+            input[j] = (uint8_t)rand_r(&seed);
+        run_one_input(input, len);
+    }
+    printf("%d inputs passed with ring size %d\n", SMOKE_TEST_INPUTS, N);
+    return EXIT_SUCCESS;
+}
+#endif
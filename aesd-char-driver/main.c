@@ -15,21 +15,116 @@
 #include <linux/errno.h>
 #include <linux/mutex.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
 
 #include "aesdchar.h"
+#include "aesd-entry-alloc.h"
+#include "aesd_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "aesdchar_trace.h"
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
 MODULE_AUTHOR("Suchith.J.N");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+/**
+ * Upper bound on the bytes of an unterminated command that the device
+ * holds on behalf of writers. It can be changed at runtime through
+ * /sys/module/aesdchar/parameters/aesd_max_pending_bytes
+ */
+static unsigned int aesd_max_pending_bytes = 64 * 1024;
+module_param(aesd_max_pending_bytes, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aesd_max_pending_bytes, "Maximum bytes buffered for a command without newline");
+
+/**
+ * Upper bound on the bytes of a single write(). Each write is copied into
+ * one allocation that may then be kept as an entry until it is evicted,
+ * so this bounds what a single writer can pin. Larger writes fail with
+ * -EFBIG.
+ */
+static unsigned int aesd_max_write_bytes = 1024 * 1024;
+module_param(aesd_max_write_bytes, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_max_write_bytes, "Maximum bytes accepted by a single write");
+
+/* Upper bound of aesd_max_write_bytes, as strndup_user() once had */
+#define AESD_MAX_WRITE_BYTES_MAX KMALLOC_MAX_SIZE
+
+/**
+ * Number of independent devices (minors), each with its own circular
+ * buffer and lock. Unrelated writers can be spread across them so that
+ * they do not contend on the same mutex.
+ */
+static unsigned int aesd_nr_devs = 1;
+module_param(aesd_nr_devs, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of aesdchar devices to create");
+
+/* Upper bound of aesd_nr_devs */
+#define AESD_NR_DEVS_MAX 256
+
+/**
+ * When set, each device keeps one circular buffer per CPU. Writers of
+ * complete commands only take the lock of their local ring and readers
+ * merge the rings in the order the entries were added.
+ */
+static bool aesd_percpu_rings = false;
+module_param(aesd_percpu_rings, bool, S_IRUGO);
+MODULE_PARM_DESC(aesd_percpu_rings, "Use per-CPU circular buffers merged on read");
+
+/**
+ * When non-zero, each device copies its entries into one contiguous arena
+ * of 2^aesd_arena_order bytes instead of keeping one allocation per entry.
+ * Reads are then at most two copies and evicting entries frees nothing.
+ * The oldest entries are also evicted when the arena runs out of room.
+ */
+static unsigned int aesd_arena_order = 0;
+module_param(aesd_arena_order, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_arena_order, "Log2 of the size of the per-device byte arena, 0 to disable");
+
+/* Bounds of aesd_arena_order */
+#define AESD_ARENA_ORDER_MIN PAGE_SHIFT
+#define AESD_ARENA_ORDER_MAX 30
+
+struct aesd_dev *aesd_devices;
+
+/**
+ * Takes the mutex of @param dev, counting the times it had to wait for it
+ */
+static void aesd_lock(struct aesd_dev *dev)
+{
+    if (mutex_trylock(&dev->lock))
+        return;
+    this_cpu_inc(dev->stats->lock_contended);
+    mutex_lock(&dev->lock);
+}
+
+static int aesd_lock_interruptible(struct aesd_dev *dev)
+{
+    if (mutex_trylock(&dev->lock))
+        return 0;
+    this_cpu_inc(dev->stats->lock_contended);
+    return mutex_lock_interruptible(&dev->lock);
+}
+
+static void __aesd_pending_reset_locked(struct aesd_dev *dev)
+{
+    kfree(dev->pending.buffptr);
+    memset(&dev->pending, 0, sizeof(dev->pending));
+}
 
 /**
  * aesd_trim empties out the aesd device and deallocates all
@@ -38,9 +133,25 @@ struct aesd_dev aesd_device;
  */
 static void __aesd_trim_locked(struct aesd_dev *dev)
 {
-    PDEBUG("aesd_trim: reset aesd circular buffer");
-    aesd_circular_buffer_destroy(&aesd_device.buf);
-    aesd_circular_buffer_init(&aesd_device.buf);
+    trace_aesd_trim(dev->minor);
+    aesd_circular_buffer_destroy(&dev->buf);
+    aesd_circular_buffer_init(&dev->buf);
+    if (dev->percpu.rings != NULL)
+        aesd_percpu_rings_trim(&dev->percpu);
+    if (dev->arena.arena != NULL)
+        aesd_byte_ring_reset(&dev->arena);
+    __aesd_pending_reset_locked(dev);
+}
+
+/**
+ * @return the number of bytes held by @param dev when it does not use
+ * per-CPU rings. This must be called holding the mutex.
+ */
+static size_t __aesd_size_locked(struct aesd_dev *dev)
+{
+    if (dev->arena.arena != NULL)
+        return aesd_byte_ring_size(&dev->arena);
+    return aesd_circular_buffer_size(&dev->buf);
 }
 
 int aesd_open(struct inode *inode, struct file *filp)
@@ -73,10 +184,10 @@ int aesd_open(struct inode *inode, struct file *filp)
          * If we cannot grab the lock, then tell the userspace
          * to restart the syscall without blocking further. 
          */
-        if (mutex_lock_interruptible(&aesd_device.lock))
+        if (aesd_lock_interruptible(dev))
             return -ERESTARTSYS;
         __aesd_trim_locked(dev);
-        mutex_unlock(&aesd_device.lock);
+        mutex_unlock(&dev->lock);
     }
 
     return 0;
@@ -88,44 +199,80 @@ int aesd_release(struct inode *inode, struct file *filp)
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * Copies the bytes at @param pos of the byte ring of @param dev into @param to.
+ * The range is contiguous in the arena apart from wrapping around its end,
+ * so it takes at most two copies. This must be called holding the mutex.
+ */
+static ssize_t __aesd_arena_read_locked(struct aesd_dev *dev, loff_t pos, struct iov_iter *to)
 {
-    PDEBUG("aesd_dev: read %zu bytes with offset %lld",count,*f_pos);
-    
-    /* If the count is 0, then we don't have to read any data */
-    if (count == 0)
-        return 0;
+    struct aesd_buffer_entry spans[2];
+    unsigned int i, nspans;
+    size_t bytes_read = 0;
 
-    /* This should not happen. The file position is not specified */
-    if (f_pos == NULL)
-        return -EINVAL;
+    nspans = aesd_byte_ring_find_spans_for_fpos(&dev->arena, pos, iov_iter_count(to), spans);
+    for (i = 0; i < nspans; i++) {
+        size_t copied = copy_to_iter(spans[i].buffptr, spans[i].size, to);
+
+        bytes_read += copied;
+        if (copied < spans[i].size)
+            return bytes_read > 0 ? bytes_read : -EFAULT;
+    }
+    return bytes_read;
+}
 
+/**
+ * Copies the bytes at *@param f_pos of @param dev into @param to and
+ * advances *@param f_pos by the number of bytes copied.
+ */
+static ssize_t __aesd_read(struct aesd_dev *dev, loff_t *f_pos, struct iov_iter *to)
+{
+    size_t count = iov_iter_count(to);
     loff_t pos = *f_pos;
+    ssize_t retval = 0;
+
+    /**
+     * Per-CPU rings are merged in sequence order under their own locks
+     * and the device mutex is not needed.
+     */
+    if (dev->percpu.rings != NULL)
+        return aesd_percpu_rings_read(&dev->percpu, f_pos, to);
 
     /**
      * We need to hold the lock throughout this operation so that the
      * contents would not be deallocated by concurrent writes while
-     * we copy the data to the userspace. Even if we are interrupted,
+     * we copy the data to the destination. Even if we are interrupted,
      * we haven't yet updated any state and hence it is safe to retry.
      * Hence use the _interruptible() variant of the mutex. 
      */
-    if (mutex_lock_interruptible(&aesd_device.lock))
+    if (aesd_lock_interruptible(dev))
         return -ERESTARTSYS;
+
+    if (dev->arena.arena != NULL) {
+        retval = __aesd_arena_read_locked(dev, pos, to);
+        if (retval > 0)
+            *f_pos = pos + retval;
+        mutex_unlock(&dev->lock);
+        return retval;
+    }
     
     /**
      * Repeatedly read the bytes off the circular buffer and copy it to
-     * the userspace memory. There are a few cases to handle
+     * the destination iterator. There are a few cases to handle
      * 1. There are enough bytes in the same segment => get the segment and done!
-     * 2. The start and end are in different segments => need to update user buffer offset as well
+     * 2. The start and end are in different segments => the iterator advances for us
      * 3. More bytes are asked than what is available => read everything from offset
      * 4. The offset is beyond the max => 0
+     *
+     * The destination can be a userspace buffer (read/readv) or a pipe
+     * (splice/sendfile). copy_to_iter() handles both, so the data never
+     * has to bounce through userspace when it is spliced into a socket.
      */
     size_t out_seg_offset;
-    size_t bytes_read = 0, user_buff_offset = 0;
+    size_t bytes_read = 0;
     while (bytes_read < count) {
         struct aesd_buffer_entry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(
-            &aesd_device.buf, pos, &out_seg_offset);
+            &dev->buf, pos, &out_seg_offset);
         
         /**
          * Entry would be NULL when we don't have data to be read. It
@@ -136,68 +283,278 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
             goto out;
         }
 
-        ssize_t bytes_reqd = count - bytes_read;
-        ssize_t bytes_available = entry->size - out_seg_offset;
+        size_t bytes_reqd = count - bytes_read;
+        size_t bytes_available = entry->size - out_seg_offset;
 
         /* Calculate the bytes available for copying from the current entry */
-        ssize_t copyable_bytes = bytes_reqd;
-        if (bytes_available < bytes_reqd) {
-            copyable_bytes = bytes_available;
-        }
+        size_t copyable_bytes = min(bytes_reqd, bytes_available);
 
         /** 
-         * Calculate the userspace and kernelspace addresses and copy the bytes 
-         * into the userspace. This can be suspended by the kernel due to the
-         * page fault. In other words, this can lead to the process calling it
-         * to be suspended (if the user page supplied is paged out). This is one
-         * reason why one cannot use spinlock, but must use a mutex.
+         * Copy the bytes into the destination. For userspace buffers this
+         * can be suspended by the kernel due to the page fault. In other words,
+         * this can lead to the process calling it to be suspended (if the user
+         * page supplied is paged out). This is one reason why one cannot use
+         * spinlock, but must use a mutex.
          */
-        void *userspace_offset = buf + user_buff_offset;
-        void *kernelspace_offset = entry->buffptr + out_seg_offset;
-        unsigned long copied = copy_to_user(userspace_offset, kernelspace_offset, 
-            (unsigned long)copyable_bytes);
-        
-        user_buff_offset += copied;
+        size_t copied = copy_to_iter(entry->buffptr + out_seg_offset,
+            copyable_bytes, to);
+
         bytes_read += copied;
         pos += copied;
+
+        /**
+         * A short copy means the destination faulted or the pipe is full.
+         * Report what we managed to copy and only fail if it was nothing.
+         */
+        if (copied < copyable_bytes) {
+            if (bytes_read == 0)
+                retval = -EFAULT;
+            goto out;
+        }
     }
 out:
     /* Finally, update the position of the file for the next call */
     *f_pos = pos;
-    mutex_unlock(&aesd_device.lock);
-    return bytes_read;
+    mutex_unlock(&dev->lock);
+    return bytes_read > 0 ? bytes_read : retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    ssize_t retval = -ENOMEM;
-    PDEBUG("aesd_dev: write %zu bytes with offset %lld",count,*f_pos);
+    struct aesd_dev *dev = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(to);
+    loff_t pos = iocb->ki_pos;
+    u64 start_ns, elapsed_ns;
+    ssize_t retval;
     
-    char *cmd = strndup_user(buf, count);
-    if (IS_ERR_OR_NULL(cmd))
-        return PTR_ERR(cmd);
+    /* If the count is 0, then we don't have to read any data */
+    if (count == 0)
+        return 0;
+
+    if (!static_branch_unlikely(&aesd_read_latency_key)) {
+        retval = __aesd_read(dev, &iocb->ki_pos, to);
+    } else {
+        start_ns = ktime_get_ns();
+        retval = __aesd_read(dev, &iocb->ki_pos, to);
+        elapsed_ns = ktime_get_ns() - start_ns;
+        this_cpu_inc(dev->stats->read_latency_ns[min_t(unsigned int, fls64(elapsed_ns),
+            AESD_LAT_HIST_BUCKETS - 1)]);
+    }
+
+    trace_aesd_read(dev->minor, pos, count, retval);
+    if (retval > 0)
+        this_cpu_add(dev->stats->bytes_out, retval);
+    return retval;
+}
+
+/**
+ * Appends @param len bytes at @param data to @param pending, growing it as
+ * needed. The caller makes sure that the result stays within
+ * aesd_max_pending_bytes. This must be called holding the mutex.
+ */
+static int __aesd_pending_append_locked(struct aesd_pending_cmd *pending, const char *data, size_t len)
+{
+    size_t reqd_cap = pending->size + len;
+
+    if (reqd_cap > pending->capacity) {
+        size_t new_cap = max_t(size_t, pending->capacity * 2, reqd_cap);
+        char *newbuf;
+
+        new_cap = min_t(size_t, new_cap, max_t(size_t, reqd_cap, aesd_max_pending_bytes));
+        newbuf = krealloc(pending->buffptr, new_cap, GFP_KERNEL);
+        if (newbuf == NULL)
+            return -ENOMEM;
+        pending->buffptr = newbuf;
+        pending->capacity = new_cap;
+    }
+    memcpy(pending->buffptr + pending->size, data, len);
+    pending->size += len;
+    return 0;
+}
+
+/**
+ * Counts of what happened to the circular buffer while committing commands
+ */
+struct aesd_commit_stats
+{
+    unsigned int added;
+    unsigned int evicted;
+};
+
+/**
+ * Adds @param entry to the device, accounting for it in @param stats. This
+ * must be called holding the mutex unless the device uses per-CPU rings.
+ */
+static void __aesd_add_entry(struct aesd_dev *dev, const struct aesd_buffer_entry *entry,
+                struct aesd_commit_stats *stats)
+{
+    size_t evicted_size;
+    bool evicted;
+
+    if (dev->percpu.rings != NULL) {
+        evicted = aesd_percpu_rings_add_entry(&dev->percpu, entry, &evicted_size);
+    } else {
+        /* A full buffer replaces its oldest entry */
+        evicted = dev->buf.full;
+        evicted_size = dev->buf.entry[dev->buf.in_offs].size;
+        aesd_circular_buffer_add_entry(&dev->buf, entry);
+    }
+    if (evicted) {
+        trace_aesd_evict(dev->minor, evicted_size);
+        stats->evicted++;
+    }
+    stats->added++;
+}
+
+/**
+ * Copies the command made of the first @param pending_size bytes of
+ * @param pending followed by @param len bytes at @param data into the byte
+ * ring of @param dev, accounting for it in @param stats. This must be called
+ * holding the mutex.
+ * @return 0, or -EFBIG if the command does not fit in the arena
+ */
+static int __aesd_arena_add_locked(struct aesd_dev *dev, const struct aesd_pending_cmd *pending,
+                size_t pending_size, const char *data, size_t len, struct aesd_commit_stats *stats)
+{
+    struct aesd_buffer_entry parts[2];
+    unsigned int nparts = 0;
+    size_t evicted_size;
+    long evicted;
+
+    if (pending_size > 0) {
+        parts[nparts].buffptr = pending->buffptr;
+        parts[nparts++].size = pending_size;
+    }
+    parts[nparts].buffptr = data;
+    parts[nparts++].size = len;
+
+    evicted = aesd_byte_ring_add_entry(&dev->arena, parts, nparts, &evicted_size);
+    if (evicted < 0)
+        return -EFBIG;
+    if (evicted > 0) {
+        trace_aesd_evict(dev->minor, evicted_size);
+        stats->evicted += evicted;
+    }
+    stats->added++;
+    return 0;
+}
+
+/**
+ * Splits @param data into newline terminated commands and adds each of them
+ * to the device. Bytes pending from earlier writes in @param pending are
+ * prepended to the first command. Trailing bytes without a newline are kept
+ * in @param pending for the next write.
+ *
+ * @param pending is NULL when the caller does not hold the mutex. This is only
+ * allowed with per-CPU rings and when @param data ends with a newline.
+ *
+ * If @param data holds exactly one command and nothing is pending, @param data
+ * itself becomes the circular buffer entry and *data_consumed is set to true.
+ * Otherwise the caller still owns @param data. With a byte ring the commands
+ * are always copied into the arena. What happened to the circular buffer is
+ * accumulated in @param stats.
+ *
+ * @return the number of bytes consumed, which is less than @param len only if
+ * an allocation failed midway or a command did not fit in the arena, or a
+ * negative error if nothing was consumed.
+ */
+static ssize_t __aesd_commit_commands(struct aesd_dev *dev, struct aesd_pending_cmd *pending,
+                char *data, size_t len, bool *data_consumed, struct aesd_commit_stats *stats)
+{
+    struct aesd_buffer_entry entry;
+    size_t pos = 0, tail_len = 0;
+    size_t pending_size = pending ? pending->size : 0;
+    char *nl;
+
+    *data_consumed = false;
 
     /**
-     * If the userspace sends a command which does not end with '\n'
-     * then we will throw an error informing them to adhere with the
-     * command format. It is much simpler to do this in userspace. 
+     * Reject the write upfront if the unterminated tail would overflow
+     * the pending command. This way a write is never partially applied
+     * because of the limit.
      */
-    __kernel_size_t cmd_size = strlen(cmd);
-    if (cmd_size > 0 && cmd[cmd_size-1] != '\n') {
-        PDEBUG("aesd_dev: command does not end with newline: %s", cmd);
-        retval = -EINVAL;
-        goto cleanup_cmd;
+    while (tail_len < len && data[len - tail_len - 1] != '\n')
+        tail_len++;
+    if (tail_len == len)
+        tail_len += pending_size;
+    if (tail_len > aesd_max_pending_bytes)
+        return -EFBIG;
+
+    while (pos < len && (nl = memchr(data + pos, '\n', len - pos)) != NULL) {
+        size_t seg_len = nl - (data + pos) + 1;
+        char *cmd;
+
+        if (dev->arena.arena != NULL) {
+            int err = __aesd_arena_add_locked(dev, pending, pending_size, data + pos, seg_len, stats);
+
+            if (err)
+                return pos > 0 ? pos : err;
+            goto next;
+        }
+
+        /* Fast path: a single complete command, hand over the buffer */
+        if (pos == 0 && seg_len == len && pending_size == 0) {
+            entry.buffptr = data;
+            entry.size = len;
+            __aesd_add_entry(dev, &entry, stats);
+            *data_consumed = true;
+            return len;
+        }
+
+        cmd = aesd_entry_alloc(pending_size + seg_len);
+        if (cmd == NULL)
+            return pos > 0 ? pos : -ENOMEM;
+        if (pending_size > 0)
+            memcpy(cmd, pending->buffptr, pending_size);
+        memcpy(cmd + pending_size, data + pos, seg_len);
+
+        entry.buffptr = cmd;
+        entry.size = pending_size + seg_len;
+        __aesd_add_entry(dev, &entry, stats);
+
+next:
+        if (pending_size > 0) {
+            pending->size = 0;
+            pending_size = 0;
+        }
+        pos += seg_len;
     }
 
-    struct aesd_buffer_entry *entry;
-    entry = kmalloc(sizeof(*entry), GFP_KERNEL);
-    if (entry == NULL) {
-        retval = -ENOMEM;
-        goto cleanup_cmd;
+    if (pos < len) {
+        if (__aesd_pending_append_locked(pending, data + pos, len - pos))
+            return pos > 0 ? pos : -ENOMEM;
+        pos = len;
+    }
+    return pos;
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct aesd_dev *dev = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(from);
+    struct aesd_commit_stats stats = { 0 };
+    ssize_t retval;
+    bool data_consumed;
+
+    if (count == 0)
+        return 0;
+    if (count > aesd_max_write_bytes)
+        return -EFBIG;
+
+    /**
+     * Copy the data in from the source iterator before taking the lock.
+     * It can be a userspace buffer (write/writev) or a pipe (splice).
+     * The data may hold any number of commands, including a partial one
+     * at the end which is completed by a later write. It is allocated as
+     * an entry so that a single command can be added to the buffer as is.
+     */
+    char *data = aesd_entry_alloc(count);
+    if (data == NULL)
+        return -ENOMEM;
+    if (!copy_from_iter_full(data, count, from)) {
+        aesd_entry_free(data);
+        return -EFAULT;
     }
-    entry->buffptr = cmd;
-    entry->size = cmd_size;
 
     /**
      * We cannot use a spinlock here because there can be a free operation
@@ -207,68 +564,391 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
      * Here, mutex_lock() is used because the syscall is not restartable. In
      * other words, this is not idempotent and adding buffer entry is quick
      */
-    mutex_lock(&aesd_device.lock);
-    aesd_circular_buffer_add_entry(&aesd_device.buf, entry);
-    mutex_unlock(&aesd_device.lock);
+    if (dev->percpu.rings != NULL && READ_ONCE(dev->pending.size) == 0 &&
+            data[count - 1] == '\n') {
+        /**
+         * With per-CPU rings, complete commands skip the mutex and only
+         * take the lock of the local ring. A partial command racing with
+         * us may become pending right after the check. That is the same
+         * as this write having happened first.
+         */
+        retval = __aesd_commit_commands(dev, NULL, data, count, &data_consumed, &stats);
+    } else {
+        aesd_lock(dev);
+        retval = __aesd_commit_commands(dev, &dev->pending, data, count, &data_consumed, &stats);
+        mutex_unlock(&dev->lock);
+    }
 
-    kfree(entry);
-    return cmd_size;
-    
-cleanup_cmd:
-    /**
-     * Internally, strndup_user calls a variant of kmalloc. Hence, we
-     * have to cleanup the memory allocated for the string with strndup_user  
-     */
-    kfree(cmd);
+    if (!data_consumed)
+        aesd_entry_free(data);
+
+    trace_aesd_write(dev->minor, count, retval, stats.added);
+    if (retval > 0)
+        this_cpu_add(dev->stats->bytes_in, retval);
+    this_cpu_add(dev->stats->evictions, stats.evicted);
+    return retval;
+}
+
+/**
+ * Supports SEEK_SET, SEEK_CUR and SEEK_END where the end is the number of
+ * bytes currently held in the circular buffer. Seeking past it is rejected.
+ */
+loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
+{
+    struct aesd_dev *dev = filp->private_data;
+    loff_t retval;
+
+    if (dev->percpu.rings != NULL)
+        return fixed_size_llseek(filp, off, whence, aesd_percpu_rings_size(&dev->percpu, NULL));
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+    retval = fixed_size_llseek(filp, off, whence, __aesd_size_locked(dev));
+    mutex_unlock(&dev->lock);
     return retval;
 }
 
+/**
+ * Copies the commands of a AESDCHAR_IOCWRITEV batch described by @param batch
+ * back to back into a single buffer allocated as an entry.
+ * @return the buffer, with its size in @param total_rtn, or an ERR_PTR
+ */
+static char *__aesd_gather_write_cmds(const struct aesd_write_batch *batch, size_t *total_rtn)
+{
+    struct aesd_write_cmd *cmds;
+    char *data = ERR_PTR(-E2BIG);
+    size_t total = 0, off = 0;
+    u64 i;
+
+    if (batch->count > AESDCHAR_BATCH_MAX_CMDS)
+        return ERR_PTR(-E2BIG);
+
+    cmds = memdup_user(u64_to_user_ptr(batch->data), batch->count * sizeof(*cmds));
+    if (IS_ERR(cmds))
+        return ERR_CAST(cmds);
+
+    for (i = 0; i < batch->count; i++) {
+        if (cmds[i].len > AESDCHAR_BATCH_MAX_BYTES - total)
+            goto out;
+        total += cmds[i].len;
+    }
+
+    data = aesd_entry_alloc(total);
+    if (data == NULL) {
+        data = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+    for (i = 0; i < batch->count; i++) {
+        if (copy_from_user(data + off, u64_to_user_ptr(cmds[i].buf), cmds[i].len)) {
+            aesd_entry_free(data);
+            data = ERR_PTR(-EFAULT);
+            goto out;
+        }
+        off += cmds[i].len;
+    }
+    *total_rtn = total;
+out:
+    kfree(cmds);
+    return data;
+}
+
+/**
+ * Handles AESDCHAR_IOCWRITEV and AESDCHAR_IOCWRITEBLOB. The whole batch is
+ * copied in first and then committed with a single acquisition of the mutex.
+ */
+static long aesd_ioctl_write_batch(struct aesd_dev *dev, unsigned int cmd,
+                struct aesd_write_batch __user *ubatch)
+{
+    struct aesd_commit_stats stats = { 0 };
+    struct aesd_write_batch batch;
+    bool data_consumed;
+    size_t total = 0;
+    ssize_t retval;
+    char *data;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.count == 0)
+        goto report;
+
+    if (cmd == AESDCHAR_IOCWRITEV) {
+        data = __aesd_gather_write_cmds(&batch, &total);
+        if (IS_ERR(data))
+            return PTR_ERR(data);
+    } else {
+        if (batch.count > AESDCHAR_BATCH_MAX_BYTES)
+            return -E2BIG;
+        total = batch.count;
+        data = aesd_entry_alloc(total);
+        if (data == NULL)
+            return -ENOMEM;
+        if (copy_from_user(data, u64_to_user_ptr(batch.data), total)) {
+            aesd_entry_free(data);
+            return -EFAULT;
+        }
+    }
+
+    if (total == 0) {
+        aesd_entry_free(data);
+        goto report;
+    }
+
+    aesd_lock(dev);
+    retval = __aesd_commit_commands(dev, &dev->pending, data, total, &data_consumed, &stats);
+    mutex_unlock(&dev->lock);
+
+    if (!data_consumed)
+        aesd_entry_free(data);
+    trace_aesd_write(dev->minor, total, retval, stats.added);
+    this_cpu_add(dev->stats->evictions, stats.evicted);
+    if (retval < 0)
+        return retval;
+    this_cpu_add(dev->stats->bytes_in, retval);
+    total = retval;
+
+report:
+    batch.accepted = stats.added;
+    batch.evicted = stats.evicted;
+    if (copy_to_user(ubatch, &batch, sizeof(batch)))
+        return -EFAULT;
+    return total;
+}
+
+/**
+ * Handles AESDCHAR_IOCSEEKTO by translating the entry index and the offset
+ * within it to a file position. Both lookups are constant time, except with
+ * per-CPU rings where the rings have to be merged first.
+ */
+static long aesd_ioctl_seekto(struct file *filp, struct aesd_dev *dev,
+                struct aesd_seekto __user *useekto)
+{
+    struct aesd_seekto seekto;
+    size_t fpos;
+    bool found;
+
+    if (copy_from_user(&seekto, useekto, sizeof(seekto)))
+        return -EFAULT;
+
+    if (dev->percpu.rings != NULL) {
+        found = aesd_percpu_rings_find_fpos_for_entry_offset(&dev->percpu,
+            seekto.write_cmd, seekto.write_cmd_offset, &fpos);
+    } else {
+        if (aesd_lock_interruptible(dev))
+            return -ERESTARTSYS;
+        if (dev->arena.arena != NULL)
+            found = aesd_byte_ring_find_fpos_for_entry_offset(&dev->arena,
+                seekto.write_cmd, seekto.write_cmd_offset, &fpos);
+        else
+            found = aesd_circular_buffer_find_fpos_for_entry_offset(&dev->buf,
+                seekto.write_cmd, seekto.write_cmd_offset, &fpos) != NULL;
+        mutex_unlock(&dev->lock);
+    }
+
+    if (!found)
+        return -EINVAL;
+    filp->f_pos = fpos;
+    return 0;
+}
+
+long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct aesd_dev *dev = filp->private_data;
+
+    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd) {
+    case AESDCHAR_IOCWRITEV:
+    case AESDCHAR_IOCWRITEBLOB:
+        return aesd_ioctl_write_batch(dev, cmd, (struct aesd_write_batch __user *)arg);
+    case AESDCHAR_IOCSEEKTO:
+        return aesd_ioctl_seekto(filp, dev, (struct aesd_seekto __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
 struct file_operations aesd_fops = {
-    .owner =    THIS_MODULE,
-    .read =     aesd_read,
-    .write =    aesd_write,
-    .open =     aesd_open,
-    .release =  aesd_release,
+    .owner =           THIS_MODULE,
+    .llseek =          aesd_llseek,
+    .read_iter =       aesd_read_iter,
+    .write_iter =      aesd_write_iter,
+    /**
+     * The splice helpers are built on top of read_iter/write_iter and
+     * let sendfile()/splice() move data between the circular buffer and
+     * a pipe or socket without a round trip through userspace.
+     */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read =     copy_splice_read,
+#else
+    .splice_read =     generic_file_splice_read,
+#endif
+    .splice_write =    iter_file_splice_write,
+    .unlocked_ioctl =  aesd_unlocked_ioctl,
+    .compat_ioctl =    compat_ptr_ioctl,
+    .open =            aesd_open,
+    .release =         aesd_release,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add(&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/**
+ * Sets up the device at @param index. Undoes everything on failure.
+ */
+static int aesd_init_device(struct aesd_dev *dev, unsigned int index)
+{
+    int result;
+
+    dev->minor = aesd_minor + index;
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (dev->stats == NULL)
+        return -ENOMEM;
+
+    /**
+     * Initialise the circular buffer needed for storing
+     * entries from the userspace. This must be destroyed
+     * by deallocating all the space.
+     */
+    aesd_circular_buffer_init(&dev->buf);
+    mutex_init(&dev->lock);
+
+    if (aesd_percpu_rings) {
+        result = aesd_percpu_rings_init(&dev->percpu);
+        if (result)
+            goto destroy_mutex;
+    }
+
+    if (aesd_arena_order) {
+        size_t arena_size = 1UL << aesd_arena_order;
+        char *arena = kvmalloc(arena_size, GFP_KERNEL);
+
+        if (arena == NULL) {
+            result = -ENOMEM;
+            goto destroy_percpu_rings;
+        }
+        aesd_byte_ring_init(&dev->arena, arena, arena_size);
+    }
+
+    result = aesd_setup_cdev(dev, index);
+    if (result)
+        goto free_arena;
+
+    aesd_debugfs_add_dev(dev);
+    return 0;
+
+free_arena:
+    kvfree(dev->arena.arena);
+destroy_percpu_rings:
+    aesd_percpu_rings_destroy(&dev->percpu);
+destroy_mutex:
+    mutex_destroy(&dev->lock);
+    free_percpu(dev->stats);
+    return result;
+}
+
+/**
+ * Tears down the first @param count devices. They must have been set up
+ * with aesd_init_device() and debugfs must be gone already.
+ */
+static void aesd_destroy_devices(unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        struct aesd_dev *dev = &aesd_devices[i];
+
+        cdev_del(&dev->cdev);
+
+        /**
+         * Make sure the memory associated with the
+         * device is freed before destroying the mutex.
+         * This is because it needs to be held which means
+         * it needs to be alive.
+         */
+        mutex_lock(&dev->lock);
+        __aesd_trim_locked(dev);
+        mutex_unlock(&dev->lock);
+
+        aesd_percpu_rings_destroy(&dev->percpu);
+        kvfree(dev->arena.arena);
+        mutex_destroy(&dev->lock);
+        free_percpu(dev->stats);
+    }
+}
+
 int __init aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1, "aesdchar");
+    unsigned int i;
+
+    if (aesd_nr_devs == 0 || aesd_nr_devs > AESD_NR_DEVS_MAX) {
+        printk(KERN_WARNING "aesd_nr_devs must be between 1 and %d\n", AESD_NR_DEVS_MAX);
+        return -EINVAL;
+    }
+
+    if (aesd_max_write_bytes == 0 || aesd_max_write_bytes > AESD_MAX_WRITE_BYTES_MAX) {
+        printk(KERN_WARNING "aesd_max_write_bytes must be between 1 and %lu\n",
+            (unsigned long)AESD_MAX_WRITE_BYTES_MAX);
+        return -EINVAL;
+    }
+
+    if (aesd_arena_order && (aesd_percpu_rings || aesd_arena_order < AESD_ARENA_ORDER_MIN ||
+            aesd_arena_order > AESD_ARENA_ORDER_MAX)) {
+        printk(KERN_WARNING "aesd_arena_order must be between %d and %d and cannot be "
+            "combined with aesd_percpu_rings\n", AESD_ARENA_ORDER_MIN, AESD_ARENA_ORDER_MAX);
+        return -EINVAL;
+    }
+
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs, "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
+
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (aesd_devices == NULL) {
+        result = -ENOMEM;
+        goto unregister_region;
+    }
 
     /**
-     * Initialise the circular buffer needed for storing
-     * entries from the userspace. This must be destroyed
-     * by deallocating all the space.
+     * The entry caches must be ready before the devices go live
+     * since a write can come in as soon as a cdev is added.
      */
-    aesd_circular_buffer_init(&aesd_device.buf);
-    mutex_init(&aesd_device.lock);
-
-    result = aesd_setup_cdev(&aesd_device);
-    if(result) {
-        unregister_chrdev_region(dev, 1);
+    result = aesd_entry_alloc_init();
+    if (result)
+        goto free_devices;
+
+    aesd_debugfs_init();
+    for (i = 0; i < aesd_nr_devs; i++) {
+        result = aesd_init_device(&aesd_devices[i], i);
+        if (result) {
+            aesd_debugfs_destroy();
+            aesd_destroy_devices(i);
+            goto destroy_entry_alloc;
+        }
     }
+    return 0;
+
+destroy_entry_alloc:
+    aesd_entry_alloc_destroy();
+free_devices:
+    kfree(aesd_devices);
+unregister_region:
+    unregister_chrdev_region(dev, aesd_nr_devs);
     return result;
 }
 
@@ -276,21 +956,12 @@ void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-    cdev_del(&aesd_device.cdev);
-
-    /**
-     * Make sure the memory associated with the
-     * device is freed before destroying the mutex.
-     * This is because it needs to be held which means
-     * it needs to be alive.
-     */
-    mutex_lock(&aesd_device.lock);
-    __aesd_trim_locked(&aesd_device);
-    mutex_unlock(&aesd_device.lock);
-
-    mutex_destroy(&aesd_device.lock);
+    aesd_debugfs_destroy();
+    aesd_destroy_devices(aesd_nr_devs);
+    kfree(aesd_devices);
+    aesd_entry_alloc_destroy();
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, aesd_nr_devs);
 }
 
 module_init(aesd_init_module);
@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
 #include <syslog.h>
 #include <errno.h>
 #include <unistd.h>
@@ -12,8 +14,67 @@
 #include <sys/stat.h>
 
 #include "connhandler.h"
+#include "storagebench.h"
+#include "metrics.h"
+#include "placement.h"
+#include "trace.h"
 
 static pthread_t sig_handler_thread;
+// Where SIGUSR2 writes the trace to
+static const char *trace_path = TRACE_DUMP_PATH;
+
+// Parses lines:bytes per second of -l and -g, 0 for no limit
+static void _parse_rate_limits(conn_handler_rate_limits_t *limits, const char *arg) {
+  char *end;
+  limits->lines_per_sec = strtol(arg, &end, 10);
+  if (*end == ':') {
+    limits->bytes_per_sec = strtol(end + 1, &end, 10);
+  }
+  if (*end != '\0' || limits->lines_per_sec < 0 || limits->bytes_per_sec < 0) {
+    fprintf(stderr, "invalid rate limits %s, must be lines:bytes per second\n", arg);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Parses records[:path] of -T
+static int _parse_trace(const char *arg) {
+  char *end;
+  long records = strtol(arg, &end, 10);
+  if (*end == ':' && end[1] != '\0') {
+    trace_path = end + 1;
+  } else if (*end != '\0') {
+    records = 0;
+  }
+  if (records <= 0 || records > INT_MAX) {
+    fprintf(stderr, "invalid trace %s, must be records[:path]\n", arg);
+    exit(EXIT_FAILURE);
+  }
+  return records;
+}
+
+// Parses name:port of -C into the next channel of the config. The name
+// ends up in a file name, so it is kept to letters, digits, - and _.
+static void _add_channel(conn_handler_config_t *config, char *arg) {
+  char *port = strchr(arg, ':');
+  if (port == NULL || port == arg || port[1] == '\0') {
+    fprintf(stderr, "invalid channel %s, must be name:port\n", arg);
+    exit(EXIT_FAILURE);
+  }
+  *port++ = '\0';
+  for (char *c = arg; *c != '\0'; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_') {
+      fprintf(stderr, "invalid channel name %s\n", arg);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (config->nr_channels == CONN_HANDLER_MAX_CHANNELS - 1) {
+    fprintf(stderr, "too many channels, at most %d can be added\n", CONN_HANDLER_MAX_CHANNELS - 1);
+    exit(EXIT_FAILURE);
+  }
+  config->channels[config->nr_channels].name = arg;
+  config->channels[config->nr_channels].port = port;
+  config->nr_channels++;
+}
 
 static void *__signal_handler(void *data) {
   sigset_t *set = (sigset_t *)data;
@@ -24,11 +85,21 @@ static void *__signal_handler(void *data) {
       perror("error while waiting for the signal");
       exit(EXIT_FAILURE);  
     }
+    if (sig == SIGUSR1) {
+      metrics_dump();
+      continue;
+    }
+    if (sig == SIGUSR2) {
+      if (trace_dump(trace_path) == 0) {
+        syslog(LOG_INFO, "Wrote the trace to %s", trace_path);
+      }
+      continue;
+    }
     printf("got signal: %d", sig);
     syslog(LOG_INFO, "Caught signal, exiting");
-    closelog();
+    // The server loop in main() tears the connections down and returns
     conn_handler_subsystem_shutdown();
-    _exit(EXIT_SUCCESS);
+    return NULL;
   }
 }
 
@@ -38,13 +109,116 @@ static void _launch_signal_handler_thread(sigset_t *sigmask) {
 
 int main(int argc, char* argv[]) {
   bool daemon_mode = false;
-  for (int i = 1; i < argc; i++) {
-    if (strcmp(argv[i], "-d") == 0) {
-      daemon_mode = true;
-      break;
+  bool bench_mode = false;
+  int bench_threads = STORAGE_BENCH_DEFAULT_THREADS;
+  const storage_ops_t *bench_engine = NULL;
+  placement_config_t placement_config = { 0 };
+  int trace_records = 0;
+  conn_handler_config_t config = {
+    .storage_engine = &AESD_DEFAULT_STORAGE_OPS,
+    .port = AESD_SERVER_PORT,
+  };
+
+  // -s picks the storage engine, overriding the build time default. -c and
+  // -f are short for -s chardev and -s file. -p lets instances with
+  // different storage run side by side. -u adds a unix socket for local
+  // clients, speaking the same protocol. -r hot restarts a server running
+  // with the same options, see handoff.h. -C name:port adds a channel, a
+  // separate log served on its own port. -l and -g limit the lines and
+  // bytes per second read from each client and from all of them. -a and -w
+  // pin the event loop and the connection threads to CPU lists, -S sets
+  // the stack size of the latter, or of each coroutine with -m, see
+  // placement.h. -m serves the connections with coroutines on that many
+  // threads. -T keeps a trace of the last that many lines, written out on
+  // SIGUSR2 to the path after the colon if there is one, see trace.h. -b
+  // runs the storage benchmark instead of the server, against every engine
+  // unless -s is given.
+  int opt;
+  while ((opt = getopt(argc, argv, "dcfp:u:rC:l:g:a:w:S:m:T:s:bt:")) != -1) {
+    switch (opt) {
+      case 'd':
+        daemon_mode = true;
+        break;
+      case 'c':
+        config.storage_engine = bench_engine = &chardev_storage_ops;
+        break;
+      case 'f':
+        config.storage_engine = bench_engine = &file_storage_ops;
+        break;
+      case 's':
+        config.storage_engine = bench_engine = storage_find_engine(optarg);
+        if (config.storage_engine == NULL) {
+          fprintf(stderr, "unknown storage engine %s, must be one of: ", optarg);
+          storage_print_engines(stderr);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'p':
+        config.port = optarg;
+        break;
+      case 'u':
+        config.unix_path = optarg;
+        break;
+      case 'r':
+        config.take_over = true;
+        break;
+      case 'C':
+        _add_channel(&config, optarg);
+        break;
+      case 'l':
+        _parse_rate_limits(&config.conn_limits, optarg);
+        break;
+      case 'g':
+        _parse_rate_limits(&config.global_limits, optarg);
+        break;
+      case 'a':
+        placement_config.loop_cpus = optarg;
+        break;
+      case 'w':
+        placement_config.worker_cpus = optarg;
+        break;
+      case 'm':
+        config.coroutine_threads = atoi(optarg);
+        if (config.coroutine_threads <= 0) {
+          fprintf(stderr, "invalid number of coroutine threads %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'T':
+        trace_records = _parse_trace(optarg);
+        break;
+      case 'S':
+        placement_config.worker_stack_size = placement_parse_size(optarg);
+        if (placement_config.worker_stack_size == 0) {
+          fprintf(stderr, "invalid stack size %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'b':
+        bench_mode = true;
+        break;
+      case 't':
+        bench_threads = atoi(optarg);
+        if (bench_threads <= 0) {
+          fprintf(stderr, "invalid number of benchmark threads %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-d] [-c | -f | -s engine] [-p port] [-u path | -u @name] [-r] [-C name:port]... [-l lines:bytes] [-g lines:bytes] [-a cpus] [-w cpus] [-S stack size] [-m threads] [-T records[:path]] [-b [-t threads]]\n", argv[0]);
+        exit(EXIT_FAILURE);
     }
   }
 
+  placement_init(&placement_config);
+  if (trace_records > 0 && trace_init(trace_records) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (bench_mode) {
+    return storage_bench_run(bench_engine, bench_threads) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
   if (daemon_mode) {
     pid_t childpid = fork();
     if (childpid < 0) {
@@ -81,14 +255,18 @@ int main(int argc, char* argv[]) {
   sigemptyset(&set);
   sigaddset(&set, SIGINT);
   sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
   if (pthread_sigmask(SIG_BLOCK, &set, NULL) < 0) {
     perror("error while masking out the signals in main thread");
     exit(EXIT_FAILURE);
   }
 
   openlog(NULL, 0, LOG_USER);
+  placement_report();
   _launch_signal_handler_thread(&set);
-  conn_handler_subsystem_init();
+  conn_handler_subsystem_init(&config);
 
+  closelog();
   return 0;
 }
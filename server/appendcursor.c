@@ -0,0 +1,83 @@
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "appendcursor.h"
+
+// Waiting for a slot only happens with thousands of appends in flight,
+// spin for a while before giving up the CPU
+#define SLOT_SPINS_BEFORE_YIELD 128
+
+// Reservation numbers wrap at the bits left above the offset
+#define TICKET_MASK ((uint64_t)0xffff)
+
+static inline uint64_t _ticket(uint64_t v) {
+  return (v >> APPEND_CURSOR_OFFSET_BITS) & TICKET_MASK;
+}
+
+void append_cursor_init(append_cursor_t *c, size_t start) {
+  atomic_init(&c->reserved, start);
+  atomic_init(&c->committed, start);
+  // Each slot starts out with a value that does not look like the commit
+  // of the first reservation using it
+  for (uint64_t i = 0; i < APPEND_CURSOR_SLOTS; i++) {
+    atomic_init(&c->slots[i], i << APPEND_CURSOR_OFFSET_BITS);
+  }
+}
+
+bool append_cursor_reserve(append_cursor_t *c, size_t len, size_t limit, append_range_t *r) {
+  uint64_t cur = atomic_load_explicit(&c->reserved, memory_order_relaxed);
+  do {
+    size_t offset = cur & APPEND_CURSOR_OFFSET_MASK;
+    if (len > limit || offset > limit - len) {
+      return false;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(&c->reserved, &cur, cur + APPEND_CURSOR_TICKET + len,
+             memory_order_relaxed, memory_order_relaxed));
+  r->from = cur;
+  r->to = cur + APPEND_CURSOR_TICKET + len;
+  r->start = cur & APPEND_CURSOR_OFFSET_MASK;
+  return true;
+}
+
+void append_cursor_commit(append_cursor_t *c, const append_range_t *r) {
+  uint64_t ticket = _ticket(r->from);
+  atomic_uint_fast64_t *slot = &c->slots[ticket % APPEND_CURSOR_SLOTS];
+
+  // The slot is free once the reservation that used it last is below the
+  // watermark
+  unsigned int spins = 0;
+  while (((ticket - _ticket(atomic_load(&c->committed))) & TICKET_MASK) >= APPEND_CURSOR_SLOTS) {
+    if (++spins >= SLOT_SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+
+  // Publish first and look at the watermark second, while whoever moves
+  // the watermark does the opposite. With both sequentially consistent,
+  // at least one of the two sees the other and no commit is left behind.
+  atomic_store(slot, r->to);
+  uint64_t cur = atomic_load(&c->committed);
+  for (;;) {
+    uint64_t next = atomic_load(&c->slots[_ticket(cur) % APPEND_CURSOR_SLOTS]);
+    if (_ticket(next) != ((_ticket(cur) + 1) & TICKET_MASK)) {
+      break;
+    }
+    // On failure someone else moved it, carry on from where they got to.
+    // Moving it releases the bytes of every range it goes past.
+    if (atomic_compare_exchange_strong(&c->committed, &cur, next)) {
+      cur = next;
+    }
+  }
+
+  // The caller replies with the committed prefix, which has to include
+  // what it just appended. Whoever commits the ranges still in flight
+  // before this one moves the watermark past it.
+  spins = 0;
+  while ((atomic_load(&c->committed) & APPEND_CURSOR_OFFSET_MASK) < (r->to & APPEND_CURSOR_OFFSET_MASK)) {
+    if (++spins >= SLOT_SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+}
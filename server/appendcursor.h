@@ -0,0 +1,77 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_APPENDCURSOR_H
+#define __AESDSOCKET_ASSIGNMENT_APPENDCURSOR_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Lets concurrent writers append to a shared region without a lock. Each
+ * writer reserves a disjoint range with an atomic update of the reserve
+ * cursor, fills it in in parallel with the others and then commits it.
+ * The committed watermark only moves past a range once every range
+ * before it is committed too, so everything below it is complete and
+ * readers never see a hole.
+ *
+ * Commits do not wait for each other to be published. Each reservation
+ * is numbered, and its commit is published in a slot of a ring. Whoever
+ * commits the range at the watermark moves it past every published range
+ * that follows, so a writer finishing early leaves its range for a slower
+ * one to pick up. A writer waits before publishing only when
+ * APPEND_CURSOR_SLOTS reservations after the oldest uncommitted one are
+ * still in flight, until its slot is free.
+ */
+#define APPEND_CURSOR_SLOTS 4096
+
+// Cursor values pack the number of the next reservation above the offset
+#define APPEND_CURSOR_OFFSET_BITS 48
+#define APPEND_CURSOR_OFFSET_MASK (((uint64_t)1 << APPEND_CURSOR_OFFSET_BITS) - 1)
+#define APPEND_CURSOR_TICKET      ((uint64_t)1 << APPEND_CURSOR_OFFSET_BITS)
+
+typedef struct append_cursor {
+  // End of the last reserved range
+  atomic_uint_fast64_t reserved;
+  // End of the contiguous committed prefix
+  atomic_uint_fast64_t committed;
+  // The cursor value after each committed range, by reservation number
+  atomic_uint_fast64_t slots[APPEND_CURSOR_SLOTS];
+}append_cursor_t;
+
+// A reserved range, to be given back to append_cursor_commit()
+typedef struct append_range {
+  size_t start;
+  // The cursor value before the reservation
+  uint64_t from;
+  // The cursor value after it
+  uint64_t to;
+}append_range_t;
+
+void append_cursor_init(append_cursor_t *c, size_t start);
+
+// Reserves len bytes unless that would go past limit. Every successful
+// reservation must be committed, even if filling it in failed, or the
+// watermark never moves past it.
+bool append_cursor_reserve(append_cursor_t *c, size_t len, size_t limit, append_range_t *r);
+
+// Same without a limit, a single fetch-add
+static inline append_range_t append_cursor_reserve_unbounded(append_cursor_t *c, size_t len) {
+  append_range_t r;
+  r.from = atomic_fetch_add_explicit(&c->reserved, APPEND_CURSOR_TICKET + len, memory_order_relaxed);
+  r.to = r.from + APPEND_CURSOR_TICKET + len;
+  r.start = r.from & APPEND_CURSOR_OFFSET_MASK;
+  return r;
+}
+
+// Marks r as filled in, moving the watermark past it and the ranges
+// after it that are committed already if it was the oldest one left.
+// Returns once the watermark is past r, so that a reply sent right after
+// includes it.
+void append_cursor_commit(append_cursor_t *c, const append_range_t *r);
+
+// Everything below the returned offset has been committed
+static inline size_t append_cursor_committed(append_cursor_t *c) {
+  return atomic_load_explicit(&c->committed, memory_order_acquire) & APPEND_CURSOR_OFFSET_MASK;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+#include "metrics.h"
+
+// A free buffer links to the next one through its first bytes
+typedef struct free_buffer {
+  struct free_buffer *next;
+}free_buffer_t;
+
+typedef struct buffer_list {
+  free_buffer_t *head;
+  unsigned int count;
+}buffer_list_t;
+
+static __thread buffer_list_t thread_cache[BUFPOOL_NR_CLASSES];
+static __thread bool thread_cache_registered;
+
+static pthread_mutex_t central_lock = PTHREAD_MUTEX_INITIALIZER;
+static buffer_list_t central[BUFPOOL_NR_CLASSES];
+static size_t central_bytes;
+
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void _bufpool_flush_thread_cache(void *unused);
+
+static int _bufpool_class(size_t size) {
+  int shift = BUFPOOL_MIN_SHIFT;
+  while (((size_t)1 << shift) < size) {
+    shift++;
+  }
+  return shift - BUFPOOL_MIN_SHIFT;
+}
+
+static size_t _bufpool_class_size(int cls) {
+  return (size_t)1 << (cls + BUFPOOL_MIN_SHIFT);
+}
+
+static void *_buffer_list_pop(buffer_list_t *l) {
+  free_buffer_t *b = l->head;
+  if (b != NULL) {
+    l->head = b->next;
+    l->count--;
+  }
+  return b;
+}
+
+static void _buffer_list_push(buffer_list_t *l, void *buf) {
+  free_buffer_t *b = (free_buffer_t *)buf;
+  b->next = l->head;
+  l->head = b;
+  l->count++;
+}
+
+static void _bufpool_create_key() {
+  pthread_key_create(&thread_cache_key, _bufpool_flush_thread_cache);
+}
+
+// The destructor of a key only runs for threads that set a value for it
+static void _bufpool_register_thread_cache() {
+  pthread_once(&thread_cache_key_once, _bufpool_create_key);
+  pthread_setspecific(thread_cache_key, thread_cache);
+  thread_cache_registered = true;
+}
+
+// Gives a buffer to the central list, or back to malloc if it is full.
+// Must be called holding central_lock.
+static void _bufpool_put_central_locked(int cls, void *buf) {
+  size_t size = _bufpool_class_size(cls);
+  if (central_bytes + size > BUFPOOL_CENTRAL_MAX_BYTES) {
+    free(buf);
+    metrics_inc(bufpool_frees);
+    return;
+  }
+  _buffer_list_push(&central[cls], buf);
+  central_bytes += size;
+}
+
+static void _bufpool_flush_thread_cache(void *unused) {
+  pthread_mutex_lock(&central_lock);
+  for (int cls = 0; cls < BUFPOOL_NR_CLASSES; cls++) {
+    void *buf;
+    while ((buf = _buffer_list_pop(&thread_cache[cls])) != NULL) {
+      _bufpool_put_central_locked(cls, buf);
+    }
+  }
+  pthread_mutex_unlock(&central_lock);
+}
+
+void *bufpool_get(size_t size, size_t *cap) {
+  if (size > BUFPOOL_MAX_SIZE) {
+    return NULL;
+  }
+  int cls = _bufpool_class(size);
+  *cap = _bufpool_class_size(cls);
+
+  void *buf = _buffer_list_pop(&thread_cache[cls]);
+  if (buf != NULL) {
+    metrics_inc(bufpool_thread_hits);
+    return buf;
+  }
+
+  pthread_mutex_lock(&central_lock);
+  buf = _buffer_list_pop(&central[cls]);
+  if (buf != NULL) {
+    central_bytes -= *cap;
+  }
+  pthread_mutex_unlock(&central_lock);
+  if (buf != NULL) {
+    metrics_inc(bufpool_central_hits);
+    return buf;
+  }
+
+  metrics_inc(bufpool_misses);
+  buf = malloc(*cap);
+  if (buf == NULL) {
+    perror("bufpool: memory allocation failed");
+    return NULL;
+  }
+  metrics_inc(bufpool_allocs);
+  return buf;
+}
+
+void bufpool_put(void *buf, size_t cap) {
+  int cls = _bufpool_class(cap);
+
+  if (cap <= BUFPOOL_CACHE_MAX_SIZE && thread_cache[cls].count < BUFPOOL_CACHE_DEPTH) {
+    if (!thread_cache_registered) {
+      _bufpool_register_thread_cache();
+    }
+    _buffer_list_push(&thread_cache[cls], buf);
+    return;
+  }
+  pthread_mutex_lock(&central_lock);
+  _bufpool_put_central_locked(cls, buf);
+  pthread_mutex_unlock(&central_lock);
+}
@@ -0,0 +1,36 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_BUFPOOL_H
+#define __AESDSOCKET_ASSIGNMENT_BUFPOOL_H
+
+#include <stddef.h>
+
+/**
+ * Size classed buffer pool. Buffers come in powers of two from
+ * BUFPOOL_MIN_SIZE to BUFPOOL_MAX_SIZE. Freed buffers go to a small cache
+ * of the calling thread first, then to a central list shared by all the
+ * threads, and are only handed back to malloc when both are full. The
+ * cache of a thread moves to the central list when the thread exits, so
+ * short lived connection threads still reuse each other's buffers.
+ *
+ * Buffers are not zeroed, neither when they are allocated nor reused.
+ */
+#define BUFPOOL_MIN_SHIFT 8
+#define BUFPOOL_MAX_SHIFT 20
+#define BUFPOOL_MIN_SIZE  ((size_t)1 << BUFPOOL_MIN_SHIFT)
+#define BUFPOOL_MAX_SIZE  ((size_t)1 << BUFPOOL_MAX_SHIFT)
+#define BUFPOOL_NR_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+
+// Buffers per class kept by each thread, only for classes up to
+// BUFPOOL_CACHE_MAX_SIZE so that idle threads do not sit on large ones
+#define BUFPOOL_CACHE_DEPTH    4
+#define BUFPOOL_CACHE_MAX_SIZE ((size_t)64 * 1024)
+// Bytes kept on the central lists, over all classes
+#define BUFPOOL_CENTRAL_MAX_BYTES ((size_t)8 * 1024 * 1024)
+
+// Returns a buffer of at least size bytes, at most BUFPOOL_MAX_SIZE, and
+// stores its actual size in *cap. NULL if malloc fails.
+void *bufpool_get(size_t size, size_t *cap);
+
+// Takes back a buffer from bufpool_get() with the cap it returned
+void bufpool_put(void *buf, size_t cap);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "storage.h"
+
+#define REPLY_BUFFER_SIZE (64 * 1024)
+// Each write() is copied into one allocation of the driver, so longer
+// lines are refused rather than handed over in one piece. Writing them
+// in parts would let lines of other connections in between.
+#define CHARDEV_STORE_MAX_FD_APPEND (1024 * 1024)
+
+// Buffers for sending the contents of the char device back to the
+// client, which cannot go through sendfile(). They are large, so they
+// are kept on a free list and reused across replies instead of being
+// allocated for each of them.
+typedef union reply_buffer {
+  union reply_buffer *next;
+  char data[REPLY_BUFFER_SIZE];
+}reply_buffer_t;
+
+// Appends to the aesdchar device. The driver serializes writers itself,
+// so there is no lock here. The device is not ours to remove on shutdown.
+typedef struct chardev_store {
+  int fd;
+  pthread_mutex_t reply_buffer_pool_lock;
+  reply_buffer_t *reply_buffer_pool;
+}chardev_store_t;
+
+static reply_buffer_t *_reply_buffer_get(chardev_store_t *cs) {
+  pthread_mutex_lock(&cs->reply_buffer_pool_lock);
+  reply_buffer_t *b = cs->reply_buffer_pool;
+  if (b != NULL) {
+    cs->reply_buffer_pool = b->next;
+  }
+  pthread_mutex_unlock(&cs->reply_buffer_pool_lock);
+
+  if (b == NULL) {
+    b = (reply_buffer_t *)malloc(sizeof(reply_buffer_t));
+    if (b == NULL) {
+      perror("failed to allocate reply buffer");
+    }
+  }
+  return b;
+}
+
+static void _reply_buffer_put(chardev_store_t *cs, reply_buffer_t *b) {
+  pthread_mutex_lock(&cs->reply_buffer_pool_lock);
+  b->next = cs->reply_buffer_pool;
+  cs->reply_buffer_pool = b;
+  pthread_mutex_unlock(&cs->reply_buffer_pool_lock);
+}
+
+static int chardev_store_open(storage_t *st) {
+  chardev_store_t *cs = (chardev_store_t *)malloc(sizeof(chardev_store_t));
+  if (cs == NULL) {
+    perror("failed to allocate char device store");
+    return -1;
+  }
+  // The driver only accepts O_APPEND | O_TRUNC and clears itself on open
+  cs->fd = open(st->path, O_RDWR | O_APPEND | O_TRUNC);
+  if (cs->fd == -1) {
+    perror("error while opening the char device");
+    free(cs);
+    return -1;
+  }
+  pthread_mutex_init(&cs->reply_buffer_pool_lock, NULL);
+  cs->reply_buffer_pool = NULL;
+  st->priv = cs;
+  return 0;
+}
+
+static ssize_t chardev_store_append(storage_t *st, const char *data, size_t len) {
+  chardev_store_t *cs = (chardev_store_t *)st->priv;
+  return write(cs->fd, data, len);
+}
+
+static int chardev_store_send_snapshot(storage_t *st, int sockfd) {
+  chardev_store_t *cs = (chardev_store_t *)st->priv;
+  reply_buffer_t *b = _reply_buffer_get(cs);
+  off_t fileoffset = 0;
+  int retval = -1;
+
+  if (b == NULL) {
+    return -1;
+  }
+  while (true) {
+    ssize_t bytes_read = pread(cs->fd, b->data, REPLY_BUFFER_SIZE, fileoffset);
+    if (bytes_read < 0) {
+      perror("error while reading the char device");
+      break;
+    }
+    if (bytes_read == 0) {
+      retval = 0;
+      break;
+    }
+    fileoffset += bytes_read;
+    if (storage_send_all(sockfd, b->data, bytes_read) < 0) {
+      break;
+    }
+  }
+  _reply_buffer_put(cs, b);
+  return retval;
+}
+
+static void chardev_store_shutdown(storage_t *st) {
+  chardev_store_t *cs = (chardev_store_t *)st->priv;
+  close(cs->fd);
+  while (cs->reply_buffer_pool != NULL) {
+    reply_buffer_t *b = cs->reply_buffer_pool;
+    cs->reply_buffer_pool = b->next;
+    free(b);
+  }
+  pthread_mutex_destroy(&cs->reply_buffer_pool_lock);
+  free(cs);
+}
+
+const storage_ops_t chardev_storage_ops = {
+  .name = "chardev",
+  .default_path = AESD_CHARDEV_PATH,
+  .open = chardev_store_open,
+  .append = chardev_store_append,
+  .max_fd_append = CHARDEV_STORE_MAX_FD_APPEND,
+  .send_snapshot = chardev_store_send_snapshot,
+  .shutdown = chardev_store_shutdown,
+};
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdatomic.h>
 #include <stdbool.h>
@@ -5,8 +6,6 @@
 #include <syslog.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/sendfile.h>
-#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -14,65 +13,276 @@
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 
 #include "connhandler.h"
-#include "linkedlist.h"
+#include "handletable.h"
 #include "linebuffer.h"
+#include "storage.h"
+#include "unixsock.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "placement.h"
+#include "coroutine.h"
+#include "trace.h"
 
 #define MAX_DATABUFFER_SIZE     1024
 #define TIMESTAMP_INTERVAL_SECS 10
+#define TIMESTAMP_BUFFER_SIZE   128
+
+// The timestamp timer, the shutdown request and the hot restart socket
+// come first, the listening sockets after them
+enum { POLL_TIMER, POLL_WAKEUP, POLL_HANDOFF, POLL_FIRST_LISTENER };
+
+/**
+ * The formatted timestamp of the current minute. Time zone offsets are
+ * whole minutes, so within a minute only the two digits of the seconds
+ * differ and are written in place, localtime() and strftime() only run
+ * once the minute changes.
+ */
+typedef struct timestamp_cache {
+  time_t minute;
+  size_t seconds_offset;
+  size_t len;
+  char buf[TIMESTAMP_BUFFER_SIZE];
+}timestamp_cache_t;
+
+typedef struct rate_limiters {
+  rate_limiter_t lines;
+  rate_limiter_t bytes;
+}rate_limiters_t;
+
+typedef struct listener {
+  int fd;
+  channel_t *channel;
+}listener_t;
+
+static handle_table_t conn_handlers;
+
+// Handlers that may still use the storage, teardown waits for them to
+// be done before closing it
+static pthread_mutex_t live_handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t live_handlers_done = PTHREAD_COND_INITIALIZER;
+static int live_handlers;
+
+static channel_t channels[CONN_HANDLER_MAX_CHANNELS];
+static int nr_channels;
+static listener_t listeners[CONN_HANDLER_MAX_LISTENERS];
+static int nr_listeners;
+static int timerfd;
+// Written to by the signal thread, which starts before this exists
+static int wakeupfd = -1;
+// Listens for a new server taking over, and the connection from it
+static int handofffd = -1;
+static int handoffconnfd = -1;
+
+static conn_handler_config_t conn_handler_config;
 
-static linked_list_t conn_handlers;
-
-static pthread_t timestamp_logger_thread;
+static atomic_bool close_conn_handler;
 
-static pthread_mutex_t outfile_lock;
+// Shared by all the connections
+static rate_limiters_t global_limiters;
 
-static int outfilefd;
-static int sockfd;
+static pthread_attr_t worker_attr;
 
-static atomic_bool close_conn_handler;
+static timestamp_cache_t timestamp_cache = { .minute = -1 };
 
 static void __conn_handler_server();
-static void _conn_handler_free_handler_data(linked_list_node_t *node);
-static void _conn_handler_subsystem_init_outfile();
-static void _conn_handler_subsystem_start_timestamp_logger();
-static void _conn_handler_close_sockets(linked_list_node_t *node);
+static void _conn_handler_free_handler_data(conn_handler_t *h);
+static void _conn_handler_init_channels();
+static void _conn_handler_subsystem_init_storage(bool resume);
+static int _conn_handler_describe_listeners(char *buf, size_t len);
+static void _conn_handler_init_listeners(const int *taken_over);
+static bool _conn_handler_take_over(int *fds);
+static void _conn_handler_open_handoff_listener();
+static bool _conn_handler_accept_handoff();
+static void _conn_handler_add_listener(int fd, channel_t *channel);
+static int _conn_handler_open_tcp_listener(const char *port);
+static int _conn_handler_open_unix_listener();
+static void _conn_handler_accept(listener_t *l);
+static void _conn_handler_arm_timer();
+static void _conn_handler_on_timer();
+static void _conn_handler_teardown();
+static void _conn_handler_shutdown_socket(handle_t handle, void *data, void *arg);
+static void _conn_handler_wait_handlers();
+static void _conn_handler_leave(conn_handler_t *h);
 static void *_conn_handler_do(void *a);
+static void *_conn_handler_thread(void *a);
+static void _conn_handler_coro(void *a);
+static ssize_t _conn_handler_read(conn_handler_t *h, char *buf, size_t len);
+static void _conn_handler_init_limiters(rate_limiters_t *l, const conn_handler_rate_limits_t *limits);
+static void _conn_handler_throttle(conn_handler_t *h, rate_limiters_t *conn_limiters, size_t bytes, size_t lines);
 
-static int __conn_handler_write_to_outfile_threadsafe(char *line, size_t line_len);
-static void *__conn_handler_timestamp_logger(void *a);
+static const char *timestamp_cache_format(timestamp_cache_t *c, time_t t, size_t *len);
 
 static void get_peer_address(struct sockaddr *addr, char *addr_buffer, int maxlen);
 
-void conn_handler_subsystem_init() {
-  atomic_store(&close_conn_handler, false);
-  conn_handlers = linked_list_create();
-  _conn_handler_subsystem_init_outfile();
-  _conn_handler_subsystem_start_timestamp_logger();
-  __conn_handler_server(); 
+void conn_handler_subsystem_init(const conn_handler_config_t *config) {
+  conn_handler_config = *config;
+  // Made first thing so that a signal during the rest of the setup can
+  // still wake the event loop. One that comes even earlier leaves
+  // close_conn_handler set, which the loop checks before it polls.
+  wakeupfd = eventfd(0, EFD_CLOEXEC);
+  if (wakeupfd == -1) {
+    perror("cannot create the shutdown eventfd");
+    exit(EXIT_FAILURE);
+  }
+  // The event loop runs on the thread calling this
+  placement_apply_loop();
+  pthread_attr_init(&worker_attr);
+  placement_worker_attr(&worker_attr);
+  if (conn_handler_config.coroutine_threads > 0 &&
+      coro_runtime_init(conn_handler_config.coroutine_threads, placement_worker_stack_size(),
+        &worker_attr, placement_apply_worker) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  handle_table_init(&conn_handlers);
+  _conn_handler_init_limiters(&global_limiters, &conn_handler_config.global_limits);
+  _conn_handler_init_channels();
+  // The running server closes its storage before it hands its sockets
+  // over, so the data files are only opened once they are here
+  int taken_over[CONN_HANDLER_MAX_LISTENERS];
+  bool took_over = conn_handler_config.take_over && _conn_handler_take_over(taken_over);
+  _conn_handler_init_listeners(took_over ? taken_over : NULL);
+  _conn_handler_subsystem_init_storage(took_over);
+  _conn_handler_open_handoff_listener();
+
+  timerfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+  if (timerfd == -1) {
+    perror("cannot create the timestamp timer");
+    exit(EXIT_FAILURE);
+  }
+  _conn_handler_arm_timer();
+
+  __conn_handler_server();
+  _conn_handler_teardown();
 }
 
+// Only asks the event loop to stop, conn_handler_subsystem_init() then
+// tears everything down and returns
 void conn_handler_subsystem_shutdown() {
   atomic_store(&close_conn_handler, true);
 
-  close(sockfd);
-  linked_list_destroy(&conn_handlers, _conn_handler_close_sockets);
-
-  // Hold the lock while closing the outfile so that there are no
-  // concurrent I/Os while this happens.
-  pthread_mutex_lock(&outfile_lock);
-  close(outfilefd);
-  if (unlink(AESD_DATAFILE_PATH) < 0) {
-    perror("failed to delete the datafile");
+  int fd = wakeupfd;
+  if (fd < 0) {
+    return;
+  }
+  uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+    perror("failed to wake up the event loop");
   }
-  pthread_mutex_unlock(&outfile_lock);
-  pthread_cancel(timestamp_logger_thread);
-  pthread_join(timestamp_logger_thread, NULL);
 }
 
 static void __conn_handler_server() {
+  struct pollfd fds[POLL_FIRST_LISTENER + CONN_HANDLER_MAX_LISTENERS] = {
+    [POLL_TIMER]    = { .fd = timerfd,  .events = POLLIN },
+    [POLL_WAKEUP]   = { .fd = wakeupfd, .events = POLLIN },
+    [POLL_HANDOFF]  = { .fd = handofffd, .events = POLLIN },
+  };
+  for (int i = 0; i < nr_listeners; i++) {
+    fds[POLL_FIRST_LISTENER + i].fd = listeners[i].fd;
+    fds[POLL_FIRST_LISTENER + i].events = POLLIN;
+  }
+
+  while(!atomic_load(&close_conn_handler)) {
+    if (poll(fds, POLL_FIRST_LISTENER + nr_listeners, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("error while poll()");
+      break;
+    }
+    if (fds[POLL_WAKEUP].revents) {
+      break;
+    }
+    if (fds[POLL_HANDOFF].revents && _conn_handler_accept_handoff()) {
+      break;
+    }
+    if (fds[POLL_TIMER].revents) {
+      _conn_handler_on_timer();
+    }
+    for (int i = 0; i < nr_listeners; i++) {
+      if (fds[POLL_FIRST_LISTENER + i].revents) {
+        _conn_handler_accept(&listeners[i]);
+      }
+    }
+  }
+}
+
+static void _conn_handler_init_channels() {
+  const char *default_path = conn_handler_config.storage_engine->default_path;
+
+  channels[0].name = CONN_HANDLER_DEFAULT_CHANNEL;
+  nr_channels = 1;
+  for (int i = 0; i < conn_handler_config.nr_channels; i++) {
+    const char *name = conn_handler_config.channels[i].name;
+    for (int j = 0; j < nr_channels; j++) {
+      if (strcmp(channels[j].name, name) == 0) {
+        fprintf(stderr, "channel %s is given more than once\n", name);
+        exit(EXIT_FAILURE);
+      }
+    }
+    channel_t *ch = &channels[nr_channels];
+    ch->name = name;
+    if (default_path != NULL) {
+      size_t path_size = strlen(default_path) + strlen(name) + 2;
+      ch->path = (char *)malloc(path_size);
+      if (ch->path == NULL) {
+        perror("failed to allocate channel path");
+        exit(EXIT_FAILURE);
+      }
+      // Device nodes cannot be made up, each minor of the driver is one
+      if (conn_handler_config.storage_engine == &chardev_storage_ops) {
+        snprintf(ch->path, path_size, "%s%d", default_path, nr_channels);
+      } else {
+        snprintf(ch->path, path_size, "%s-%s", default_path, name);
+      }
+    }
+    nr_channels++;
+  }
+}
+
+// The default channel's port and unix socket, then the other channels'
+// ports, one per line with the channel each of them serves. A server
+// taking over asks for its sockets with this and they are handed over
+// in this order too. Returns 0, or -1 if it does not fit.
+static int _conn_handler_describe_listeners(char *buf, size_t len) {
+  size_t n = snprintf(buf, len, "tcp %s %s\n", conn_handler_config.port, CONN_HANDLER_DEFAULT_CHANNEL);
+  if (n < len && conn_handler_config.unix_path != NULL) {
+    n += snprintf(buf + n, len - n, "unix %s %s\n", conn_handler_config.unix_path, CONN_HANDLER_DEFAULT_CHANNEL);
+  }
+  for (int i = 0; n < len && i < conn_handler_config.nr_channels; i++) {
+    n += snprintf(buf + n, len - n, "tcp %s %s\n", conn_handler_config.channels[i].port,
+      conn_handler_config.channels[i].name);
+  }
+  return n < len ? 0 : -1;
+}
+
+static void _conn_handler_init_listeners(const int *taken_over) {
+  _conn_handler_add_listener(taken_over != NULL ? taken_over[nr_listeners] :
+    _conn_handler_open_tcp_listener(conn_handler_config.port), &channels[0]);
+  if (conn_handler_config.unix_path != NULL) {
+    _conn_handler_add_listener(taken_over != NULL ? taken_over[nr_listeners] :
+      _conn_handler_open_unix_listener(), &channels[0]);
+  }
+  for (int i = 0; i < conn_handler_config.nr_channels; i++) {
+    _conn_handler_add_listener(taken_over != NULL ? taken_over[nr_listeners] :
+      _conn_handler_open_tcp_listener(conn_handler_config.channels[i].port), &channels[i + 1]);
+  }
+}
+
+static void _conn_handler_add_listener(int fd, channel_t *channel) {
+  listeners[nr_listeners].fd = fd;
+  listeners[nr_listeners].channel = channel;
+  nr_listeners++;
+}
+
+static int _conn_handler_open_tcp_listener(const char *port) {
   struct addrinfo hints;
   struct addrinfo *servinfo;
 
@@ -81,13 +291,13 @@ static void __conn_handler_server() {
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_flags = AI_PASSIVE;
 
-  int status = getaddrinfo(NULL, "9000", &hints, &servinfo);
+  int status = getaddrinfo(NULL, port, &hints, &servinfo);
   if (status != 0) {
     fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
     exit(EXIT_FAILURE);
   }
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd == -1) {
     perror("cannot create server socket");
     freeaddrinfo(servinfo);
@@ -95,7 +305,7 @@ static void __conn_handler_server() {
   }
 
   if (bind(sockfd, servinfo->ai_addr, sizeof(*(servinfo->ai_addr))) != 0) {
-    perror("cannot bind the socket to port 9000");
+    fprintf(stderr, "cannot bind the socket to port %s: %s\n", port, strerror(errno));
     freeaddrinfo(servinfo);
     exit(EXIT_FAILURE);
   }
@@ -105,86 +315,246 @@ static void __conn_handler_server() {
     perror("error listening on the socket");
     exit(EXIT_FAILURE);
   }
+  return sockfd;
+}
 
-  while(!atomic_load(&close_conn_handler)) {
-    struct sockaddr client_address;
-    socklen_t client_address_len = sizeof(client_address);
-    char client_addr_buffer[MAX_IP_LENGTH+1];
-
-    int clientsockfd = accept(sockfd, &client_address, &client_address_len);
-    if (clientsockfd < 0) {
-      perror("error while accept()");
-      break;
-    }
-    get_peer_address(&client_address, client_addr_buffer, MAX_IP_LENGTH+1);
-    syslog(LOG_INFO, "Accepted connection from %s", client_addr_buffer);
-    
-    conn_handler_create_and_launch_handler(clientsockfd, client_addr_buffer);
+static int _conn_handler_open_unix_listener() {
+  int sockfd = unix_socket_listen(conn_handler_config.unix_path);
+  if (sockfd == -1) {
+    fprintf(stderr, "cannot listen on %s: %s\n", conn_handler_config.unix_path, strerror(errno));
+    exit(EXIT_FAILURE);
   }
+  return sockfd;
 }
 
-static void _conn_handler_close_sockets(linked_list_node_t *node) {
-  conn_handler_t *h = (conn_handler_t *)(node->data);
-  if (shutdown(h->clientsockfd, SHUT_RDWR) != 0) {
-    perror("failed to shutdown client socket");
+// Takes the listening sockets over from a server running on the same
+// port into fds. Returns false if there is none.
+static bool _conn_handler_take_over(int *fds) {
+  char path[HANDOFF_PATH_SIZE];
+  handoff_path(path, HANDOFF_PATH_SIZE, conn_handler_config.port);
+
+  int fd = unix_socket_connect(path);
+  if (fd == -1) {
+    syslog(LOG_INFO, "No server running on port %s to take over from", conn_handler_config.port);
+    return false;
   }
-  close(h->clientsockfd);
-  // pthread_join(h->handler_thread, NULL);
-  _conn_handler_free_handler_data(node);
+  char listeners[HANDOFF_MAX_REQUEST_SIZE];
+  int n = -1;
+  if (_conn_handler_describe_listeners(listeners, sizeof(listeners)) == 0 &&
+      handoff_request(fd, listeners) == 0) {
+    n = handoff_receive(fd, fds, CONN_HANDLER_MAX_LISTENERS);
+  }
+  close(fd);
+  if (n < 0) {
+    fprintf(stderr, "failed to take the listening sockets over, is the server running with other options?\n");
+    exit(EXIT_FAILURE);
+  }
+  syslog(LOG_INFO, "Took %d listening sockets over", n);
+  return true;
 }
 
-static void _conn_handler_subsystem_init_outfile() {
-  pthread_mutex_init(&outfile_lock, NULL);
-  outfilefd = open(AESD_DATAFILE_PATH, O_CREAT | O_TRUNC | O_RDWR | O_APPEND, 0666);
-  if (outfilefd == -1) {
-    perror("error while opening the output file");
-    exit(EXIT_FAILURE);
+// Not being able to hand over later is no reason not to serve now
+static void _conn_handler_open_handoff_listener() {
+  char path[HANDOFF_PATH_SIZE];
+  handoff_path(path, HANDOFF_PATH_SIZE, conn_handler_config.port);
+
+  handofffd = unix_socket_listen(path);
+  if (handofffd == -1) {
+    syslog(LOG_WARNING, "cannot listen on %s, hot restart disabled: %s", path + 1, strerror(errno));
   }
 }
 
-static void _conn_handler_subsystem_start_timestamp_logger() {
-  pthread_create(&timestamp_logger_thread, NULL, __conn_handler_timestamp_logger, NULL);
+// Returns true once a new server of the same user with the same
+// listeners asked for them
+static bool _conn_handler_accept_handoff() {
+  handoffconnfd = accept(handofffd, NULL, NULL);
+  if (handoffconnfd < 0) {
+    return false;
+  }
+  char ours[HANDOFF_MAX_REQUEST_SIZE];
+  char requested[HANDOFF_MAX_REQUEST_SIZE];
+  if (!handoff_peer_allowed(handoffconnfd)) {
+    syslog(LOG_WARNING, "Refusing to hand the listening sockets over to another user");
+    goto refuse;
+  }
+  if (_conn_handler_describe_listeners(ours, sizeof(ours)) < 0 ||
+      handoff_read_request(handoffconnfd, requested, sizeof(requested)) < 0 ||
+      strcmp(requested, ours) != 0) {
+    syslog(LOG_WARNING, "Refusing to hand the listening sockets over to a server with other listeners");
+    goto refuse;
+  }
+  syslog(LOG_INFO, "Handing the listening sockets over to a new server");
+  return true;
+
+refuse:
+  close(handoffconnfd);
+  handoffconnfd = -1;
+  return false;
 }
 
-static void *__conn_handler_timestamp_logger(void *a) {
-  const unsigned int TIME_BUFFER_SIZE = 256;
-  char timestamp_buffer[TIME_BUFFER_SIZE];
-  memset(timestamp_buffer, 0, TIME_BUFFER_SIZE);
-  
-  while (!atomic_load(&close_conn_handler)) {
-    unsigned int rem_time = sleep(TIMESTAMP_INTERVAL_SECS);
-    if (rem_time > 0 && atomic_load(&close_conn_handler)) {
-      return NULL;
+static void _conn_handler_accept(listener_t *l) {
+  struct sockaddr_storage client_address;
+  socklen_t client_address_len = sizeof(client_address);
+  char client_addr_buffer[MAX_IP_LENGTH+1];
+
+  int clientsockfd = accept(l->fd, (struct sockaddr *)&client_address, &client_address_len);
+  if (clientsockfd < 0) {
+    // The client may have gone away between poll() and accept()
+    if (errno != EINTR && errno != ECONNABORTED) {
+      perror("error while accept()");
     }
+    return;
+  }
+  get_peer_address((struct sockaddr *)&client_address, client_addr_buffer, MAX_IP_LENGTH+1);
+  syslog(LOG_INFO, "Accepted connection from %s", client_addr_buffer);
+  
+  conn_handler_create_and_launch_handler(clientsockfd, client_addr_buffer, l->channel);
+}
 
-    if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-      perror("failed to disable timestamp logger cancelation");
-      exit(EXIT_FAILURE);
+// The timer fires on the wall clock multiples of the interval. It is
+// cancelled if the clock is set, so it can be armed again for the new time.
+static void _conn_handler_arm_timer() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  struct itimerspec its = {
+    .it_interval = { .tv_sec = TIMESTAMP_INTERVAL_SECS },
+    .it_value = { .tv_sec = (now.tv_sec / TIMESTAMP_INTERVAL_SECS + 1) * TIMESTAMP_INTERVAL_SECS },
+  };
+  if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) != 0) {
+    perror("cannot arm the timestamp timer");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void _conn_handler_on_timer() {
+  uint64_t expirations;
+  if (read(timerfd, &expirations, sizeof(expirations)) < 0) {
+    if (errno == ECANCELED) {
+      _conn_handler_arm_timer();
     }
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    strftime(timestamp_buffer, TIME_BUFFER_SIZE, "timestamp:%a, %d %b %Y %T %z\n", tm_info);
-    
-    size_t ts_len = strlen(timestamp_buffer);
-    int bytes_written = __conn_handler_write_to_outfile_threadsafe(timestamp_buffer, ts_len);
+    return;
+  }
+
+  // A single timestamp stands for any ticks that were missed, stamped
+  // with the tick that just passed
+  time_t t = time(NULL);
+  t -= t % TIMESTAMP_INTERVAL_SECS;
+
+  size_t ts_len;
+  const char *ts = timestamp_cache_format(&timestamp_cache, t, &ts_len);
+  for (int i = 0; i < nr_channels; i++) {
+    ssize_t bytes_written = storage_append(channels[i].storage, ts, ts_len);
     if (bytes_written < 0) {
       perror("error while appending timestamp");
-      goto reenable_thread_cancelation;
+      continue;
     }
-    if (bytes_written < ts_len) {
+    if ((size_t)bytes_written < ts_len) {
       syslog(LOG_WARNING, "fewer bytes written than timestamp. Maybe running out of disk space");
     }
-  
-  reenable_thread_cancelation:
-    if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) < 0) {
-      perror("failed to re-enable timestamp logger cancelation");
+  }
+}
+
+// On a hot restart the listening sockets live on in the new server and
+// the data file is kept for it. Client connections are not handed over,
+// they are shut down either way.
+static void _conn_handler_teardown() {
+  bool handing_off = handoffconnfd >= 0;
+
+  // Frees the name for the new server
+  if (handofffd >= 0) {
+    close(handofffd);
+  }
+  close(timerfd);
+  int fd = wakeupfd;
+  wakeupfd = -1;
+  close(fd);
+  // Wakes every handler thread up, each of them then closes its socket
+  // and removes itself from the table. Lines already read are still
+  // appended, so the storage has to outlive all of them.
+  handle_table_foreach(&conn_handlers, _conn_handler_shutdown_socket, NULL);
+  _conn_handler_wait_handlers();
+
+  for (int i = 0; i < nr_channels; i++) {
+    channels[i].storage->keep = handing_off;
+    storage_close(channels[i].storage);
+    free(channels[i].path);
+  }
+
+  int fds[CONN_HANDLER_MAX_LISTENERS];
+  for (int i = 0; i < nr_listeners; i++) {
+    fds[i] = listeners[i].fd;
+  }
+  if (handing_off) {
+    handoff_send(handoffconnfd, fds, nr_listeners);
+    close(handoffconnfd);
+  } else if (conn_handler_config.unix_path != NULL) {
+    unix_socket_unlink(conn_handler_config.unix_path);
+  }
+  for (int i = 0; i < nr_listeners; i++) {
+    close(fds[i]);
+  }
+}
+
+static const char *timestamp_cache_format(timestamp_cache_t *c, time_t t, size_t *len) {
+  time_t minute = t / 60;
+  if (minute != c->minute) {
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    c->seconds_offset = strftime(c->buf, TIMESTAMP_BUFFER_SIZE, "timestamp:%a, %d %b %Y %H:%M:", &tm_info);
+    c->len = strftime(c->buf, TIMESTAMP_BUFFER_SIZE, "timestamp:%a, %d %b %Y %T %z\n", &tm_info);
+    c->minute = minute;
+  } else {
+    int seconds = t % 60;
+    c->buf[c->seconds_offset] = '0' + seconds / 10;
+    c->buf[c->seconds_offset + 1] = '0' + seconds % 10;
+  }
+  *len = c->len;
+  return c->buf;
+}
+
+static void _conn_handler_shutdown_socket(handle_t handle, void *data, void *arg) {
+  conn_handler_t *h = (conn_handler_t *)data;
+  if (shutdown(h->clientsockfd, SHUT_RDWR) != 0) {
+    perror("failed to shutdown client socket");
+  }
+}
+
+static void _conn_handler_wait_handlers() {
+  pthread_mutex_lock(&live_handlers_lock);
+  while (live_handlers > 0) {
+    pthread_cond_wait(&live_handlers_done, &live_handlers_lock);
+  }
+  pthread_mutex_unlock(&live_handlers_lock);
+}
+
+// Leave the table before closing the socket, so that shutting down
+// cannot hit a descriptor that has been reused by then
+static void _conn_handler_leave(conn_handler_t *h) {
+  handle_table_remove(&conn_handlers, h->handle);
+  pthread_mutex_lock(&live_handlers_lock);
+  if (--live_handlers == 0) {
+    pthread_cond_broadcast(&live_handlers_done);
+  }
+  pthread_mutex_unlock(&live_handlers_lock);
+}
+
+static void _conn_handler_subsystem_init_storage(bool resume) {
+  for (int i = 0; i < nr_channels; i++) {
+    channels[i].storage = storage_open(conn_handler_config.storage_engine, channels[i].path, resume);
+    if (channels[i].storage == NULL) {
+      fprintf(stderr, "failed to open the %s storage of channel %s\n",
+        conn_handler_config.storage_engine->name, channels[i].name);
+      if (i > 0 && conn_handler_config.storage_engine == &chardev_storage_ops) {
+        fprintf(stderr, "the driver needs aesd_nr_devs=%d or more for %d channels\n",
+          nr_channels, nr_channels);
+      }
       exit(EXIT_FAILURE);
     }
   }
-  return NULL;
 }
 
-conn_handler_t *conn_handler_create_and_launch_handler(int clientsockfd, char *client_address) {
+conn_handler_t *conn_handler_create_and_launch_handler(int clientsockfd, char *client_address, channel_t *channel) {
   conn_handler_t *h = (conn_handler_t*)malloc(sizeof(conn_handler_t));
   if (h == NULL) {
     perror("failed to allocate handler");
@@ -200,27 +570,77 @@ conn_handler_t *conn_handler_create_and_launch_handler(int clientsockfd, char *c
   
   h->clientsockfd = clientsockfd;
   h->client_address = client_address_buffer;
-  h->node = linked_list_append_front(&conn_handlers, (void *)h);
-  if (h->node == NULL) {
-    perror("failed to append to handlers list");
+  h->channel = channel;
+  h->handle = handle_table_insert(&conn_handlers, (void *)h);
+  if (h->handle == HANDLE_INVALID) {
+    fprintf(stderr, "failed to add the handler to the table\n");
+    close(clientsockfd);
+    _conn_handler_free_handler_data(h);
+    return NULL;
+  }
+  pthread_mutex_lock(&live_handlers_lock);
+  live_handlers++;
+  pthread_mutex_unlock(&live_handlers_lock);
+  if (conn_handler_config.coroutine_threads == 0) {
+    if (pthread_create(&h->handler_thread, &worker_attr, _conn_handler_thread, h) != 0) {
+      fprintf(stderr, "failed to start a thread for the connection\n");
+      _conn_handler_leave(h);
+      close(clientsockfd);
+      _conn_handler_free_handler_data(h);
+      return NULL;
+    }
+    return h;
+  }
+  // A coroutine waiting for its socket has to give the thread up rather
+  // than block it
+  if (fcntl(clientsockfd, F_SETFL, fcntl(clientsockfd, F_GETFL) | O_NONBLOCK) < 0 ||
+      coro_spawn(_conn_handler_coro, h) < 0) {
+    fprintf(stderr, "failed to start a coroutine for the connection\n");
+    _conn_handler_leave(h);
+    close(clientsockfd);
+    _conn_handler_free_handler_data(h);
     return NULL;
   }
-  pthread_create(&h->handler_thread, NULL, _conn_handler_do, h);
   return h;
 }
 
+static void *_conn_handler_thread(void *a) {
+  placement_apply_worker();
+  return _conn_handler_do(a);
+}
+
+static void _conn_handler_coro(void *a) {
+  _conn_handler_do(a);
+}
+
+// The socket is only non-blocking when served by a coroutine
+static ssize_t _conn_handler_read(conn_handler_t *h, char *buf, size_t len) {
+  for (;;) {
+    ssize_t res = read(h->clientsockfd, buf, len);
+    if (res >= 0 || (errno != EAGAIN && errno != EINTR)) {
+      return res;
+    }
+    if (errno == EAGAIN && coro_wait_fd(h->clientsockfd, POLLIN, -1) < 0) {
+      return -1;
+    }
+  }
+}
+
 static void *_conn_handler_do(void *a) {
   conn_handler_t *h = (conn_handler_t *)a;
+  storage_t *storage = h->channel->storage;
 
   struct line_buffer lb;
   ssize_t line_len;
   ssize_t total_bytes_written = 0;
   char data_buffer[MAX_DATABUFFER_SIZE];
+  rate_limiters_t conn_limiters;
 
   line_buffer_init(&lb);
+  _conn_handler_init_limiters(&conn_limiters, &conn_handler_config.conn_limits);
 
   while (!atomic_load(&close_conn_handler)) {
-    int bytes_read = read(h->clientsockfd, data_buffer, MAX_DATABUFFER_SIZE);
+    int bytes_read = _conn_handler_read(h, data_buffer, MAX_DATABUFFER_SIZE);
     if (bytes_read == 0) { 
       break;
     }
@@ -228,14 +648,43 @@ static void *_conn_handler_do(void *a) {
       perror("error while reading from the socket");
       break;
     }
+    uint64_t recv_ns = trace_on() ? trace_now() : 0;
     int start = 0;
+    size_t lines = 0;
     for (int i = 0; i < bytes_read; i++) {
       if (data_buffer[i] != '\n') {
         continue;
       }
-      line_buffer_append(&lb, data_buffer+start, i-start+1);
+      lines++;
+      if (line_buffer_append(&lb, data_buffer+start, i-start+1) < 0) {
+        goto cleanup_client;
+      }
       char *line = line_buffer_get(&lb, &line_len);
-      int bytes_written = __conn_handler_write_to_outfile_threadsafe(line, line_len);
+
+      // The engine stamps TRACE_LOCKED through trace_current while it
+      // appends, nothing can switch to another coroutine meanwhile
+      trace_record_t trace;
+      bool traced = trace_on();
+      if (traced) {
+        memset(&trace, 0, sizeof(trace));
+        trace.conn = h->handle;
+        trace.line_len = line_len;
+        trace.ts[TRACE_RECV] = recv_ns;
+        trace.ts[TRACE_FRAMED] = trace_now();
+        trace_current = &trace;
+      }
+
+      ssize_t bytes_written;
+      if (line_buffer_spilled(&lb)) {
+        bytes_written = storage_append_fd(storage, line_buffer_spill_fd(&lb), line_len);
+        metrics_inc(lines_spilled);
+      } else {
+        bytes_written = storage_append(storage, line, line_len);
+      }
+      if (traced) {
+        trace.ts[TRACE_APPENDED] = trace_now();
+        trace_current = NULL;
+      }
       if (bytes_written < 0) {
         perror("error while appending line");
         goto cleanup_client; 
@@ -246,45 +695,66 @@ static void *_conn_handler_do(void *a) {
       total_bytes_written += bytes_written;
       line_buffer_clear(&lb);
 
-      off_t fileoffset = 0;
-      while (true) {
-        int res = sendfile(h->clientsockfd, outfilefd, &fileoffset, MAX_DATABUFFER_SIZE);
-        if (res < 0) {
-          perror("error while sending file output to socket");
-          goto cleanup_client;
-        }
-        printf("sent %d bytes", res);
-        if (res == 0) {
-          break;
-        }
+      if (storage_send_snapshot(storage, h->clientsockfd) < 0) {
+        goto cleanup_client;
+      }
+      if (traced) {
+        trace.ts[TRACE_REPLIED] = trace_now();
+        trace_commit(&trace);
       }
 
       start = i+1;
     }
-    line_buffer_append(&lb, data_buffer+start, bytes_read-start);
+    if (line_buffer_append(&lb, data_buffer+start, bytes_read-start) < 0) {
+      break;
+    }
+    _conn_handler_throttle(h, &conn_limiters, bytes_read, lines);
   }
 cleanup_client:
+  _conn_handler_leave(h);
   close(h->clientsockfd);
   line_buffer_destroy(&lb);
   syslog(LOG_INFO, "Closed connection from %s", h->client_address);
-  linked_list_remove_node(&conn_handlers, h->node, _conn_handler_free_handler_data);
+  _conn_handler_free_handler_data(h);
   return NULL;
 }
 
-static void _conn_handler_free_handler_data(linked_list_node_t *node) {
-  if (node == NULL) {
+static void _conn_handler_init_limiters(rate_limiters_t *l, const conn_handler_rate_limits_t *limits) {
+  rate_limiter_init(&l->lines, limits->lines_per_sec);
+  rate_limiter_init(&l->bytes, limits->bytes_per_sec);
+}
+
+// Pauses reading from the client until its own and the global buckets
+// allow for more. What the client sends meanwhile stays in the socket
+// buffers, so TCP pushes back on it instead of data getting dropped.
+static void _conn_handler_throttle(conn_handler_t *h, rate_limiters_t *conn_limiters, size_t bytes, size_t lines) {
+  uint64_t now = rate_limiter_now_ns();
+  uint64_t waits[] = {
+    rate_limiter_take(&conn_limiters->lines, lines, now),
+    rate_limiter_take(&conn_limiters->bytes, bytes, now),
+    rate_limiter_take(&global_limiters.lines, lines, now),
+    rate_limiter_take(&global_limiters.bytes, bytes, now),
+  };
+  uint64_t wait_ns = 0;
+  for (size_t i = 0; i < sizeof(waits) / sizeof(waits[0]); i++) {
+    if (waits[i] > wait_ns) {
+      wait_ns = waits[i];
+    }
+  }
+  if (wait_ns == 0) {
     return;
   }
-  conn_handler_t *h = (conn_handler_t *)(node->data);
-  free(h->client_address);
-  free(h);
+  metrics_inc(throttle_pauses);
+  metrics_add(throttle_wait_us, wait_ns / 1000);
+
+  // Asking for no events still reports POLLHUP, which shutting the
+  // socket down raises, so the pause does not hold up a shutdown
+  coro_wait_fd(h->clientsockfd, 0, (wait_ns + 999999) / 1000000);
 }
 
-static int __conn_handler_write_to_outfile_threadsafe(char *line, size_t line_len) {
-  pthread_mutex_lock(&outfile_lock);
-  int bytes_written = write(outfilefd, line, line_len);
-  pthread_mutex_unlock(&outfile_lock);
-  return bytes_written;
+static void _conn_handler_free_handler_data(conn_handler_t *h) {
+  free(h->client_address);
+  free(h);
 }
 
 static void get_peer_address(struct sockaddr *sa, char *addr_buffer, int maxlen) {
@@ -296,5 +766,10 @@ static void get_peer_address(struct sockaddr *sa, char *addr_buffer, int maxlen)
     case AF_INET6:
       inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)sa)->sin6_addr), addr_buffer, maxlen);
       break;
+
+    case AF_UNIX:
+      // Local clients rarely bind their end, so there is no name to show
+      snprintf(addr_buffer, maxlen, "local");
+      break;
   }
 }
\ No newline at end of file
@@ -2,22 +2,78 @@
 #define __AESDSOCKET_ASSIGNMENT_CONNHANDLER_H
 
 #include <pthread.h>
+#include <stdbool.h>
 
-#include "linkedlist.h"
+#include "handletable.h"
+#include "storage.h"
 
-#define AESD_DATAFILE_PATH "/var/tmp/aesdsocketdata"
 #define MAX_IP_LENGTH      32
-#define AESD_SERVER_PORT   9000
+#define AESD_SERVER_PORT   "9000"
+
+// The default channel and the ones given in the config
+#define CONN_HANDLER_MAX_CHANNELS    8
+#define CONN_HANDLER_DEFAULT_CHANNEL "default"
+// A TCP port per channel and an optional unix socket
+#define CONN_HANDLER_MAX_LISTENERS   (CONN_HANDLER_MAX_CHANNELS + 1)
+
+/**
+ * A channel is an independent log with its own storage and timestamps.
+ * Clients pick one by the port they connect to, and only ever see the
+ * lines of their channel.
+ */
+typedef struct channel {
+  const char *name;
+  // The data file of the channel, NULL to use the engine's default.
+  // "<default>-<name>" for other channels, or the device of minor N for
+  // the Nth channel with the char device, see aesdchar_load.
+  char *path;
+  storage_t *storage;
+}channel_t;
 
 typedef struct conn_handler {
   int clientsockfd;
   char *client_address;
+  channel_t *channel;
   pthread_t handler_thread;
-  linked_list_node_t *node;
+  handle_t handle;
 }conn_handler_t;
 
-void conn_handler_subsystem_init();
+// 0 for no limit
+typedef struct conn_handler_rate_limits {
+  long lines_per_sec;
+  long bytes_per_sec;
+}conn_handler_rate_limits_t;
+
+typedef struct conn_handler_channel_config {
+  const char *name;
+  const char *port;
+}conn_handler_channel_config_t;
+
+typedef struct conn_handler_config {
+  const storage_ops_t *storage_engine;
+  // Port and unix socket of the default channel
+  const char *port;
+  // Also listen on this unix socket, '@' at the start puts it in the
+  // abstract namespace. NULL for TCP only.
+  const char *unix_path;
+  // Take the listening sockets and the data file over from a server
+  // running on the same port, see handoff.h
+  bool take_over;
+  // Channels besides the default one. Their data files are named after
+  // the engine's default one with -<name> appended.
+  conn_handler_channel_config_t channels[CONN_HANDLER_MAX_CHANNELS - 1];
+  int nr_channels;
+  // Reading from a client pauses while it, or all the clients together,
+  // go over these
+  conn_handler_rate_limits_t conn_limits;
+  conn_handler_rate_limits_t global_limits;
+  // Serve connections with coroutines on this many threads instead of a
+  // thread each, see coroutine.h. 0 for a thread each.
+  int coroutine_threads;
+}conn_handler_config_t;
+
+void conn_handler_subsystem_init(const conn_handler_config_t *config);
 void conn_handler_subsystem_shutdown();
-conn_handler_t *conn_handler_create_and_launch_handler(int clientsockfd, char *client_address);
+conn_handler_t *conn_handler_create_and_launch_handler(int clientsockfd, char *client_address, channel_t *channel);
 
 #endif
\ No newline at end of file
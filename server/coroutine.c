@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "coroutine.h"
+
+#define CORO_MAX_EVENTS  64
+#define CORO_NSEC_PER_MS 1000000ULL
+
+struct coro_sched;
+
+typedef struct coro {
+  ucontext_t ctx;
+  // The mapping of the stack, starting with its guard page
+  char *stack;
+  void (*fn)(void *arg);
+  void *arg;
+  // Links the coroutine into a queue or the list of timed waits
+  struct coro *next;
+  int wait_fd;
+  // End of a timed wait on the monotonic clock, 0 if the wait is not timed
+  uint64_t deadline_ns;
+  bool timed_out;
+  bool done;
+}coro_t;
+
+typedef struct coro_queue {
+  coro_t *head;
+  coro_t *tail;
+}coro_queue_t;
+
+typedef struct coro_sched {
+  pthread_t thread;
+  int epfd;
+  // Written to by other threads spawning a coroutine here
+  int wakefd;
+  // Protects spawned and the stack cache, which the spawning thread
+  // takes stacks from
+  pthread_mutex_t spawn_lock;
+  coro_queue_t spawned;
+  char *stack_cache[CORO_STACK_CACHE_SIZE];
+  int nr_cached_stacks;
+  // Only touched by the scheduler thread
+  coro_queue_t runnable;
+  coro_t *timers;
+  ucontext_t sched_ctx;
+  coro_t *current;
+  void (*thread_init)();
+}coro_sched_t;
+
+static coro_sched_t scheds[CORO_MAX_THREADS];
+static int nr_scheds;
+static atomic_uint next_sched;
+static size_t stack_size;
+static size_t guard_size;
+
+static __thread coro_sched_t *this_sched;
+
+static void _coro_queue_push(coro_queue_t *q, coro_t *c) {
+  c->next = NULL;
+  if (q->tail != NULL) {
+    q->tail->next = c;
+  } else {
+    q->head = c;
+  }
+  q->tail = c;
+}
+
+static coro_t *_coro_queue_pop(coro_queue_t *q) {
+  coro_t *c = q->head;
+  if (c != NULL) {
+    q->head = c->next;
+    if (q->head == NULL) {
+      q->tail = NULL;
+    }
+  }
+  return c;
+}
+
+static uint64_t _coro_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _coro_timer_insert(coro_sched_t *s, coro_t *c) {
+  coro_t **p = &s->timers;
+  while (*p != NULL && (*p)->deadline_ns <= c->deadline_ns) {
+    p = &(*p)->next;
+  }
+  c->next = *p;
+  *p = c;
+}
+
+static void _coro_timer_remove(coro_sched_t *s, coro_t *c) {
+  for (coro_t **p = &s->timers; *p != NULL; p = &(*p)->next) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  c->deadline_ns = 0;
+}
+
+// Stacks are only ever taken from and given back to the cache of the
+// scheduler the coroutine runs on
+static char *_coro_stack_get(coro_sched_t *s) {
+  char *stack = NULL;
+  pthread_mutex_lock(&s->spawn_lock);
+  if (s->nr_cached_stacks > 0) {
+    stack = s->stack_cache[--s->nr_cached_stacks];
+  }
+  pthread_mutex_unlock(&s->spawn_lock);
+  if (stack != NULL) {
+    return stack;
+  }
+
+  stack = mmap(NULL, guard_size + stack_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED) {
+    perror("coroutine: failed to allocate a stack");
+    return NULL;
+  }
+  // Overflowing the stack faults instead of overwriting whatever is below
+  if (mprotect(stack, guard_size, PROT_NONE) != 0) {
+    perror("coroutine: failed to set up the stack guard");
+    munmap(stack, guard_size + stack_size);
+    return NULL;
+  }
+  return stack;
+}
+
+static void _coro_stack_put(coro_sched_t *s, char *stack) {
+  pthread_mutex_lock(&s->spawn_lock);
+  if (s->nr_cached_stacks < CORO_STACK_CACHE_SIZE) {
+    s->stack_cache[s->nr_cached_stacks++] = stack;
+    stack = NULL;
+  }
+  pthread_mutex_unlock(&s->spawn_lock);
+  if (stack != NULL) {
+    munmap(stack, guard_size + stack_size);
+  }
+}
+
+static void _coro_trampoline() {
+  coro_sched_t *s = this_sched;
+  coro_t *c = s->current;
+  c->fn(c->arg);
+  c->done = true;
+  setcontext(&s->sched_ctx);
+}
+
+static int _coro_next_timeout_ms(coro_sched_t *s) {
+  if (s->timers == NULL) {
+    return -1;
+  }
+  uint64_t now = _coro_now_ns();
+  if (s->timers->deadline_ns <= now) {
+    return 0;
+  }
+  return (s->timers->deadline_ns - now + CORO_NSEC_PER_MS - 1) / CORO_NSEC_PER_MS;
+}
+
+// The descriptor of a timed out wait is taken out of the epoll set, so
+// that it cannot wake the coroutine up once it has moved on
+static void _coro_expire_timers(coro_sched_t *s) {
+  uint64_t now = _coro_now_ns();
+  while (s->timers != NULL && s->timers->deadline_ns <= now) {
+    coro_t *c = s->timers;
+    s->timers = c->next;
+    c->deadline_ns = 0;
+    c->timed_out = true;
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->wait_fd, NULL);
+    _coro_queue_push(&s->runnable, c);
+  }
+}
+
+static void *_coro_sched_run(void *a) {
+  coro_sched_t *s = (coro_sched_t *)a;
+  struct epoll_event events[CORO_MAX_EVENTS];
+
+  this_sched = s;
+  if (s->thread_init != NULL) {
+    s->thread_init();
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&s->spawn_lock);
+    coro_t *c;
+    while ((c = _coro_queue_pop(&s->spawned)) != NULL) {
+      _coro_queue_push(&s->runnable, c);
+    }
+    pthread_mutex_unlock(&s->spawn_lock);
+
+    while ((c = _coro_queue_pop(&s->runnable)) != NULL) {
+      s->current = c;
+      swapcontext(&s->sched_ctx, &c->ctx);
+      s->current = NULL;
+      if (c->done) {
+        _coro_stack_put(s, c->stack);
+        free(c);
+      }
+    }
+
+    int n = epoll_wait(s->epfd, events, CORO_MAX_EVENTS, _coro_next_timeout_ms(s));
+    if (n < 0) {
+      if (errno != EINTR) {
+        perror("coroutine: error while epoll_wait()");
+      }
+      n = 0;
+    }
+    for (int i = 0; i < n; i++) {
+      c = (coro_t *)events[i].data.ptr;
+      if (c == NULL) {
+        uint64_t count;
+        if (read(s->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+          perror("coroutine: failed to read the wakeup eventfd");
+        }
+        continue;
+      }
+      if (c->deadline_ns != 0) {
+        _coro_timer_remove(s, c);
+      }
+      _coro_queue_push(&s->runnable, c);
+    }
+    _coro_expire_timers(s);
+  }
+  return NULL;
+}
+
+int coro_runtime_init(int nthreads, size_t requested_stack_size, const pthread_attr_t *attr, void (*thread_init)()) {
+  if (nthreads <= 0 || nthreads > CORO_MAX_THREADS) {
+    fprintf(stderr, "coroutine: between 1 and %d threads are supported\n", CORO_MAX_THREADS);
+    return -1;
+  }
+  guard_size = sysconf(_SC_PAGESIZE);
+  stack_size = requested_stack_size != 0 ? requested_stack_size : CORO_DEFAULT_STACK_SIZE;
+  stack_size = (stack_size + guard_size - 1) / guard_size * guard_size;
+  atomic_init(&next_sched, 0);
+
+  for (int i = 0; i < nthreads; i++) {
+    coro_sched_t *s = &scheds[i];
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->spawn_lock, NULL);
+    s->thread_init = thread_init;
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    s->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (s->epfd == -1 || s->wakefd == -1) {
+      perror("coroutine: failed to set up a scheduler");
+      return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wakefd, &ev) != 0) {
+      perror("coroutine: failed to watch the wakeup eventfd");
+      return -1;
+    }
+    if (pthread_create(&s->thread, attr, _coro_sched_run, s) != 0) {
+      perror("coroutine: failed to start a scheduler");
+      return -1;
+    }
+    nr_scheds++;
+  }
+  return 0;
+}
+
+int coro_spawn(void (*fn)(void *arg), void *arg) {
+  coro_sched_t *s = &scheds[atomic_fetch_add_explicit(&next_sched, 1, memory_order_relaxed) % nr_scheds];
+  coro_t *c = (coro_t *)calloc(1, sizeof(coro_t));
+  if (c == NULL) {
+    perror("coroutine: failed to allocate");
+    return -1;
+  }
+  c->stack = _coro_stack_get(s);
+  if (c->stack == NULL) {
+    free(c);
+    return -1;
+  }
+  c->fn = fn;
+  c->arg = arg;
+  c->wait_fd = -1;
+
+  getcontext(&c->ctx);
+  c->ctx.uc_stack.ss_sp = c->stack + guard_size;
+  c->ctx.uc_stack.ss_size = stack_size;
+  c->ctx.uc_link = NULL;
+  makecontext(&c->ctx, _coro_trampoline, 0);
+
+  pthread_mutex_lock(&s->spawn_lock);
+  _coro_queue_push(&s->spawned, c);
+  pthread_mutex_unlock(&s->spawn_lock);
+
+  uint64_t one = 1;
+  if (write(s->wakefd, &one, sizeof(one)) != sizeof(one)) {
+    perror("coroutine: failed to wake up the scheduler");
+  }
+  return 0;
+}
+
+bool coro_running() {
+  return this_sched != NULL && this_sched->current != NULL;
+}
+
+int coro_wait_fd(int fd, short events, int timeout_ms) {
+  if (!coro_running()) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int res;
+    do {
+      res = poll(&pfd, 1, timeout_ms);
+    } while (res < 0 && errno == EINTR);
+    return res > 0 ? 1 : res;
+  }
+
+  coro_sched_t *s = this_sched;
+  coro_t *c = s->current;
+  // One shot, so an event only ever wakes up the wait it was armed for.
+  // The descriptor stays in the set, disarmed, until it is closed.
+  struct epoll_event ev = { .events = (uint32_t)events | EPOLLONESHOT, .data.ptr = c };
+  if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+    if (errno != ENOENT || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      perror("coroutine: failed to wait for a descriptor");
+      return -1;
+    }
+  }
+  c->wait_fd = fd;
+  c->timed_out = false;
+  if (timeout_ms >= 0) {
+    c->deadline_ns = _coro_now_ns() + (uint64_t)timeout_ms * CORO_NSEC_PER_MS;
+    _coro_timer_insert(s, c);
+  }
+  swapcontext(&c->ctx, &s->sched_ctx);
+  return c->timed_out ? 0 : 1;
+}
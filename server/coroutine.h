@@ -0,0 +1,41 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_COROUTINE_H
+#define __AESDSOCKET_ASSIGNMENT_COROUTINE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Coroutines multiplexed onto a few scheduler threads, each with its own
+ * epoll instance. A coroutine is plain sequential code with a stack of
+ * its own. When it has to wait for a descriptor it calls coro_wait_fd(),
+ * which switches back to its scheduler until the descriptor is ready, so
+ * thousands of connections can be served without a thread each.
+ *
+ * A coroutine stays on the scheduler it was spawned on. It must not hold
+ * a lock across coro_wait_fd(): another coroutine of the same thread
+ * blocking on that lock would stall the thread for good.
+ */
+#define CORO_DEFAULT_STACK_SIZE ((size_t)64 * 1024)
+#define CORO_MAX_THREADS        64
+// Stacks of finished coroutines kept by each scheduler for new ones
+#define CORO_STACK_CACHE_SIZE   64
+
+// Starts nthreads schedulers created with attr, each calling
+// thread_init first if it is not NULL. A stack_size of 0 picks
+// CORO_DEFAULT_STACK_SIZE. Returns 0 or -1.
+int coro_runtime_init(int nthreads, size_t stack_size, const pthread_attr_t *attr, void (*thread_init)());
+
+// Runs fn(arg) in a new coroutine on the next scheduler. Returns 0 or -1.
+int coro_spawn(void (*fn)(void *arg), void *arg);
+
+// Whether the caller is running in a coroutine
+bool coro_running();
+
+// Waits for fd to be ready for events (POLLIN, POLLOUT or 0 for only
+// hangups and errors) or for timeout_ms to pass, -1 waits forever.
+// Returns 1 if fd is ready, 0 on timeout and -1 on error. Outside a
+// coroutine it simply poll()s.
+int coro_wait_fd(int fd, short events, int timeout_ms);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+
+#include "storage.h"
+#include "trace.h"
+
+#define SENDFILE_CHUNK_SIZE 1024
+
+// Appends to a regular file and replies with sendfile(). The file is
+// removed on shutdown unless it is kept for a hot restart.
+typedef struct file_store {
+  pthread_mutex_t lock;
+  int fd;
+  // The same file without O_APPEND, for copy_file_range() which
+  // refuses to write to a file opened with it
+  int copy_fd;
+}file_store_t;
+
+static int file_store_open(storage_t *st) {
+  file_store_t *fs = (file_store_t *)malloc(sizeof(file_store_t));
+  if (fs == NULL) {
+    perror("failed to allocate file store");
+    return -1;
+  }
+  fs->fd = open(st->path, O_CREAT | (st->resume ? 0 : O_TRUNC) | O_RDWR | O_APPEND, 0666);
+  if (fs->fd == -1) {
+    perror("error while opening the output file");
+    free(fs);
+    return -1;
+  }
+  fs->copy_fd = open(st->path, O_WRONLY);
+  if (fs->copy_fd == -1) {
+    perror("error while opening the output file");
+    close(fs->fd);
+    free(fs);
+    return -1;
+  }
+  pthread_mutex_init(&fs->lock, NULL);
+  st->priv = fs;
+  return 0;
+}
+
+static ssize_t file_store_append(storage_t *st, const char *data, size_t len) {
+  file_store_t *fs = (file_store_t *)st->priv;
+  pthread_mutex_lock(&fs->lock);
+  trace_mark(TRACE_LOCKED);
+  ssize_t bytes_written = write(fs->fd, data, len);
+  pthread_mutex_unlock(&fs->lock);
+  return bytes_written;
+}
+
+static ssize_t file_store_append_fd(storage_t *st, int fd, size_t len) {
+  file_store_t *fs = (file_store_t *)st->priv;
+  ssize_t retval = len;
+
+  // The lock keeps other appends out while the end of the file moves
+  pthread_mutex_lock(&fs->lock);
+  trace_mark(TRACE_LOCKED);
+  off_t end = lseek(fs->fd, 0, SEEK_END);
+  if (end < 0 || storage_copy_fd_range(fd, fs->copy_fd, end, len) < 0) {
+    retval = -1;
+  }
+  pthread_mutex_unlock(&fs->lock);
+  return retval;
+}
+
+static int file_store_send_snapshot(storage_t *st, int sockfd) {
+  file_store_t *fs = (file_store_t *)st->priv;
+  off_t fileoffset = 0;
+  while (true) {
+    ssize_t res = sendfile(sockfd, fs->fd, &fileoffset, SENDFILE_CHUNK_SIZE);
+    if (res < 0 && storage_send_retry(sockfd)) {
+      continue;
+    }
+    if (res < 0) {
+      perror("error while sending file output to socket");
+      return -1;
+    }
+    if (res == 0) {
+      return 0;
+    }
+  }
+}
+
+static void file_store_shutdown(storage_t *st) {
+  file_store_t *fs = (file_store_t *)st->priv;
+
+  // Hold the lock while closing the file so that there are no
+  // concurrent appends while this happens.
+  pthread_mutex_lock(&fs->lock);
+  close(fs->fd);
+  close(fs->copy_fd);
+  if (!st->keep && unlink(st->path) < 0) {
+    perror("failed to delete the datafile");
+  }
+  pthread_mutex_unlock(&fs->lock);
+  pthread_mutex_destroy(&fs->lock);
+  free(fs);
+}
+
+const storage_ops_t file_storage_ops = {
+  .name = "file",
+  .default_path = AESD_DATAFILE_PATH,
+  .open = file_store_open,
+  .append = file_store_append,
+  .append_fd = file_store_append_fd,
+  .send_snapshot = file_store_send_snapshot,
+  .shutdown = file_store_shutdown,
+};
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "handletable.h"
+
+#define FREE_LIST_END UINT32_MAX
+
+// The slot index of a handle numbers the slots of all the shards in turn
+static inline handle_t _make_handle(uint32_t shard, uint32_t local, uint32_t generation) {
+  uint64_t index = (uint64_t)local * HANDLE_TABLE_SHARDS + shard;
+  return (index << 32) | generation;
+}
+
+static inline handle_slot_t *_shard_slot(handle_table_shard_t *s, uint32_t local) {
+  return &s->chunks[local / HANDLE_TABLE_CHUNK_SLOTS][local % HANDLE_TABLE_CHUNK_SLOTS];
+}
+
+void handle_table_init(handle_table_t *t) {
+  memset(t, 0, sizeof(*t));
+  for (int i = 0; i < HANDLE_TABLE_SHARDS; i++) {
+    pthread_mutex_init(&t->shards[i].lock, NULL);
+    t->shards[i].free_head = FREE_LIST_END;
+    atomic_init(&t->shards[i].nr_chunks, 0);
+  }
+  atomic_init(&t->next_shard, 0);
+}
+
+void handle_table_destroy(handle_table_t *t) {
+  for (int i = 0; i < HANDLE_TABLE_SHARDS; i++) {
+    handle_table_shard_t *s = &t->shards[i];
+    unsigned int nr_chunks = atomic_load(&s->nr_chunks);
+    for (unsigned int c = 0; c < nr_chunks; c++) {
+      for (int j = 0; j < HANDLE_TABLE_CHUNK_SLOTS; j++) {
+        pthread_mutex_destroy(&s->chunks[c][j].lock);
+      }
+      free(s->chunks[c]);
+    }
+    pthread_mutex_destroy(&s->lock);
+  }
+}
+
+// Adds a chunk of free slots to the shard. Must be called holding its lock.
+static int _handle_table_shard_grow_locked(handle_table_shard_t *s) {
+  unsigned int nr_chunks = atomic_load_explicit(&s->nr_chunks, memory_order_relaxed);
+  if (nr_chunks == HANDLE_TABLE_MAX_CHUNKS) {
+    return -1;
+  }
+  handle_slot_t *chunk = (handle_slot_t *)aligned_alloc(HANDLE_TABLE_CACHE_LINE,
+    HANDLE_TABLE_CHUNK_SLOTS * sizeof(handle_slot_t));
+  if (chunk == NULL) {
+    perror("handle-table: failed to allocate slots");
+    return -1;
+  }
+  uint32_t base = nr_chunks * HANDLE_TABLE_CHUNK_SLOTS;
+  for (int j = HANDLE_TABLE_CHUNK_SLOTS - 1; j >= 0; j--) {
+    pthread_mutex_init(&chunk[j].lock, NULL);
+    chunk[j].data = NULL;
+    chunk[j].generation = 1;
+    chunk[j].next_free = s->free_head;
+    s->free_head = base + j;
+  }
+  s->chunks[nr_chunks] = chunk;
+  // Publish the chunk to handle_table_foreach() which does not take the shard lock
+  atomic_store_explicit(&s->nr_chunks, nr_chunks + 1, memory_order_release);
+  return 0;
+}
+
+handle_t handle_table_insert(handle_table_t *t, void *data) {
+  uint32_t shard = atomic_fetch_add_explicit(&t->next_shard, 1, memory_order_relaxed) % HANDLE_TABLE_SHARDS;
+  handle_table_shard_t *s = &t->shards[shard];
+
+  pthread_mutex_lock(&s->lock);
+  if (s->free_head == FREE_LIST_END && _handle_table_shard_grow_locked(s) < 0) {
+    pthread_mutex_unlock(&s->lock);
+    return HANDLE_INVALID;
+  }
+  uint32_t local = s->free_head;
+  handle_slot_t *slot = _shard_slot(s, local);
+  s->free_head = slot->next_free;
+  pthread_mutex_unlock(&s->lock);
+
+  pthread_mutex_lock(&slot->lock);
+  slot->data = data;
+  handle_t h = _make_handle(shard, local, slot->generation);
+  pthread_mutex_unlock(&slot->lock);
+  return h;
+}
+
+void *handle_table_remove(handle_table_t *t, handle_t h) {
+  uint64_t index = h >> 32;
+  uint32_t generation = (uint32_t)h;
+  uint32_t shard = index % HANDLE_TABLE_SHARDS;
+  uint32_t local = index / HANDLE_TABLE_SHARDS;
+  handle_table_shard_t *s = &t->shards[shard];
+
+  if (h == HANDLE_INVALID ||
+      local / HANDLE_TABLE_CHUNK_SLOTS >= atomic_load_explicit(&s->nr_chunks, memory_order_acquire)) {
+    return NULL;
+  }
+  handle_slot_t *slot = _shard_slot(s, local);
+
+  pthread_mutex_lock(&slot->lock);
+  if (slot->generation != generation || slot->data == NULL) {
+    pthread_mutex_unlock(&slot->lock);
+    return NULL;
+  }
+  void *data = slot->data;
+  slot->data = NULL;
+  // Skip 0 so that a handle is never HANDLE_INVALID
+  if (++slot->generation == 0) {
+    slot->generation = 1;
+  }
+  pthread_mutex_unlock(&slot->lock);
+
+  pthread_mutex_lock(&s->lock);
+  slot->next_free = s->free_head;
+  s->free_head = local;
+  pthread_mutex_unlock(&s->lock);
+  return data;
+}
+
+void handle_table_foreach(handle_table_t *t, void (*f)(handle_t h, void *data, void *arg), void *arg) {
+  for (uint32_t shard = 0; shard < HANDLE_TABLE_SHARDS; shard++) {
+    handle_table_shard_t *s = &t->shards[shard];
+    unsigned int nr_chunks = atomic_load_explicit(&s->nr_chunks, memory_order_acquire);
+    for (uint32_t local = 0; local < nr_chunks * HANDLE_TABLE_CHUNK_SLOTS; local++) {
+      handle_slot_t *slot = _shard_slot(s, local);
+      pthread_mutex_lock(&slot->lock);
+      if (slot->data != NULL) {
+        f(_make_handle(shard, local, slot->generation), slot->data, arg);
+      }
+      pthread_mutex_unlock(&slot->lock);
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_HANDLETABLE_H
+#define __AESDSOCKET_ASSIGNMENT_HANDLETABLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define HANDLE_TABLE_CACHE_LINE  64
+#define HANDLE_TABLE_SHARDS      16
+#define HANDLE_TABLE_CHUNK_SLOTS 64
+#define HANDLE_TABLE_MAX_CHUNKS  64
+
+/**
+ * A handle names a slot of the table and the generation the slot was in
+ * when the handle was handed out. Once the entry is removed the slot's
+ * generation moves on, so a stale handle can never reach the next entry
+ * stored in the same slot. 0 is never a valid handle.
+ */
+typedef uint64_t handle_t;
+#define HANDLE_INVALID ((handle_t)0)
+
+/**
+ * Each slot sits on its own cache line so that connections coming and
+ * going in neighbouring slots do not bounce it between CPUs. Its lock
+ * is only held to change the slot or while handle_table_foreach() runs
+ * the callback for it.
+ */
+typedef struct handle_slot {
+  pthread_mutex_t lock;
+  void *data;
+  uint32_t generation;
+  uint32_t next_free;
+}__attribute__((aligned(HANDLE_TABLE_CACHE_LINE))) handle_slot_t;
+
+/**
+ * Slots are spread over shards, each with its own free list and lock, so
+ * inserts and removes in different shards do not contend. Slots are
+ * allocated a chunk at a time and never move.
+ */
+typedef struct handle_table_shard {
+  pthread_mutex_t lock;
+  uint32_t free_head;
+  atomic_uint nr_chunks;
+  handle_slot_t *chunks[HANDLE_TABLE_MAX_CHUNKS];
+}__attribute__((aligned(HANDLE_TABLE_CACHE_LINE))) handle_table_shard_t;
+
+typedef struct handle_table {
+  handle_table_shard_t shards[HANDLE_TABLE_SHARDS];
+  atomic_uint next_shard;
+}handle_table_t;
+
+void handle_table_init(handle_table_t *t);
+void handle_table_destroy(handle_table_t *t);
+
+// O(1). Returns HANDLE_INVALID if the table is full or out of memory.
+handle_t handle_table_insert(handle_table_t *t, void *data);
+
+// O(1). Returns the data of the entry, or NULL if the handle is stale.
+// Once it returns, no handle_table_foreach() callback is using the entry.
+void *handle_table_remove(handle_table_t *t, handle_t h);
+
+// Calls f for every entry. Only the slot being visited is locked, so
+// inserts and removes of other entries carry on meanwhile. Entries
+// inserted during the walk may or may not be visited. f must not insert
+// or remove the entry it is called for.
+void handle_table_foreach(handle_table_t *t, void (*f)(handle_t h, void *data, void *arg), void *arg);
+
+#endif
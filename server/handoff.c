@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "handoff.h"
+
+void handoff_path(char *buf, size_t len, const char *port) {
+  snprintf(buf, len, HANDOFF_PATH_FORMAT, port);
+}
+
+bool handoff_peer_allowed(int sockfd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    perror("handoff: failed to get the credentials of the peer");
+    return false;
+  }
+  return cred.uid == 0 || cred.uid == geteuid();
+}
+
+// The request is the length of the description followed by it
+int handoff_request(int sockfd, const char *listeners) {
+  uint32_t len = strlen(listeners);
+  if (send(sockfd, &len, sizeof(len), MSG_NOSIGNAL | MSG_MORE) != sizeof(len) ||
+      send(sockfd, listeners, len, MSG_NOSIGNAL) != len) {
+    perror("handoff: failed to ask for the sockets");
+    return -1;
+  }
+  return 0;
+}
+
+static int _handoff_recv_all(int sockfd, void *buf, size_t len) {
+  ssize_t res;
+  do {
+    res = recv(sockfd, buf, len, MSG_WAITALL);
+  } while (res < 0 && errno == EINTR);
+  return res >= 0 && (size_t)res == len ? 0 : -1;
+}
+
+int handoff_read_request(int sockfd, char *buf, size_t len) {
+  struct timeval timeout = {
+    .tv_sec = HANDOFF_REQUEST_TIMEOUT_MS / 1000,
+    .tv_usec = HANDOFF_REQUEST_TIMEOUT_MS % 1000 * 1000,
+  };
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+    perror("handoff: failed to set the request timeout");
+    return -1;
+  }
+  // With the timeout set, a MSG_WAITALL receive that runs out of time
+  // returns short instead of blocking
+  uint32_t request_len;
+  if (_handoff_recv_all(sockfd, &request_len, sizeof(request_len)) < 0 ||
+      request_len >= len || request_len > HANDOFF_MAX_REQUEST_SIZE ||
+      _handoff_recv_all(sockfd, buf, request_len) < 0) {
+    return -1;
+  }
+  buf[request_len] = '\0';
+  return 0;
+}
+
+// The payload is the number of descriptors, so that a receiver can tell
+// a message whose descriptors did not all fit
+int handoff_send(int sockfd, const int *fds, int nfds) {
+  uint32_t count = nfds;
+  struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+  };
+  if (nfds <= 0 || nfds > HANDOFF_MAX_FDS) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(control, 0, sizeof(control));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+  if (sendmsg(sockfd, &msg, MSG_NOSIGNAL) != sizeof(count)) {
+    perror("handoff: failed to send the sockets");
+    return -1;
+  }
+  return 0;
+}
+
+int handoff_receive(int sockfd, int *fds, int maxfds) {
+  uint32_t count;
+  struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+
+  ssize_t res;
+  do {
+    res = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+  } while (res < 0 && errno == EINTR);
+  if (res != sizeof(count)) {
+    if (res < 0) {
+      perror("handoff: failed to receive the sockets");
+    }
+    return -1;
+  }
+
+  int received = 0;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *cmsg_fds = (int *)CMSG_DATA(cmsg);
+    for (int i = 0; i < n; i++) {
+      if (received < maxfds) {
+        fds[received++] = cmsg_fds[i];
+      } else {
+        close(cmsg_fds[i]);
+      }
+    }
+  }
+  if ((msg.msg_flags & MSG_CTRUNC) || (uint32_t)received != count) {
+    fprintf(stderr, "handoff: expected %u sockets, got %d\n", count, received);
+    for (int i = 0; i < received; i++) {
+      close(fds[i]);
+    }
+    return -1;
+  }
+  return received;
+}
@@ -0,0 +1,47 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_HANDOFF_H
+#define __AESDSOCKET_ASSIGNMENT_HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Hot restart: a running server listens on a unix socket in the abstract
+ * namespace, named after its TCP port. A new server started with -r
+ * connects to it, and the running one stops, keeps its data file and
+ * passes its listening sockets over with SCM_RIGHTS. Connections waiting
+ * in the listen backlog meanwhile are accepted by the new server.
+ *
+ * Abstract sockets have no file permissions, so the running server only
+ * talks to a peer of its own user, or to root. The new server first
+ * describes the sockets it expects: the port or path of each and the
+ * channel it serves, in order. If that is not what the running one has,
+ * their options differ, and the running one refuses and carries on.
+ */
+#define HANDOFF_PATH_FORMAT         "@aesdsocket-handoff-%s"
+#define HANDOFF_PATH_SIZE           64
+#define HANDOFF_MAX_FDS             16
+#define HANDOFF_MAX_REQUEST_SIZE    1024
+// The request is read on the event loop, a peer that connects and sends
+// nothing holds it up for no longer than this
+#define HANDOFF_REQUEST_TIMEOUT_MS  500
+
+void handoff_path(char *buf, size_t len, const char *port);
+
+// Whether the peer of sockfd runs as the same user as this process, or
+// as root
+bool handoff_peer_allowed(int sockfd);
+
+int handoff_request(int sockfd, const char *listeners);
+// Reads the description of the sockets asked for into buf, NUL
+// terminated. Returns 0, or -1 if it is too long, malformed or not
+// complete within HANDOFF_REQUEST_TIMEOUT_MS.
+int handoff_read_request(int sockfd, char *buf, size_t len);
+
+// Sends the descriptors in a single message. Returns 0 or -1.
+int handoff_send(int sockfd, const int *fds, int nfds);
+
+// Receives what handoff_send() sent. Returns the number of descriptors
+// stored in fds, or -1 if the peer went away without sending them.
+int handoff_receive(int sockfd, int *fds, int maxfds);
+
+#endif
@@ -1,52 +1,102 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "linebuffer.h"
+#include "metrics.h"
+#include "bufpool.h"
+
+static ssize_t _line_buffer_spill(line_buffer_t *buff, char *c, size_t csz);
+static int _write_all(int fd, const char *c, size_t csz);
+
+static inline bool _line_buffer_is_inline(const line_buffer_t *buff) {
+  return buff->line == buff->inline_line;
+}
+
+// Only buffers from the pool count against the budgets
+static inline ssize_t _line_buffer_heap_cap(const line_buffer_t *buff) {
+  return _line_buffer_is_inline(buff) ? 0 : buff->line_cap;
+}
 
 void line_buffer_init(line_buffer_t *buff) {
-  buff->line = NULL;
+  buff->line = buff->inline_line;
   buff->line_len = 0;
-  buff->line_cap = 0;
+  buff->line_cap = LINE_BUFFER_INLINE_SIZE;
+  buff->spill_fd = -1;
 }
 
+// The bytes of the previous line are left as they are, line_len is all
+// that says what is valid
 void line_buffer_clear(line_buffer_t *buff) {
   buff->line_len = 0;
-  memset(buff->line, 0, buff->line_cap);
+  if (line_buffer_spilled(buff)) {
+    // The file is anonymous, closing it is all it takes to remove it
+    close(buff->spill_fd);
+    buff->spill_fd = -1;
+    metrics_add(spill_files_open, -1);
+  }
 }
 
 void line_buffer_destroy(line_buffer_t *buff) {
-  if (buff->line != NULL) {
-    free(buff->line);
+  if (line_buffer_spilled(buff)) {
+    line_buffer_clear(buff);
+  }
+  if (!_line_buffer_is_inline(buff)) {
+    bufpool_put(buff->line, buff->line_cap);
+    metrics_add(line_buffer_bytes, -buff->line_cap);
   }
+  line_buffer_init(buff);
 }
 
-int line_buffer_append(line_buffer_t *buff, char *c, size_t csz) {
+ssize_t line_buffer_append(line_buffer_t *buff, char *c, size_t csz) {
   if (csz == 0) {
     return buff->line_len;
   }
-  int new_size = buff->line_len + csz;
+  if (line_buffer_spilled(buff)) {
+    if (_write_all(buff->spill_fd, c, csz) < 0) {
+      return -1;
+    }
+    metrics_add(spill_bytes, csz);
+    buff->line_len += csz;
+    return buff->line_len;
+  }
+
+  ssize_t new_size = buff->line_len + csz;
   bool needs_resize = new_size > buff->line_cap;
   if (needs_resize) {
-    int reqd_cap = buff->line_cap;
-    if (reqd_cap == 0) {
-      reqd_cap = 1;
-    }
-    while (reqd_cap < new_size) {
-      reqd_cap <<= 1;
+    if (new_size > LINE_BUFFER_CONN_BUDGET || (size_t)new_size > BUFPOOL_MAX_SIZE) {
+      metrics_inc(line_buffer_budget_hits);
+      return _line_buffer_spill(buff, c, csz);
     }
-    char *newline = (char *)calloc(reqd_cap, sizeof(char));
+
+    size_t new_cap;
+    char *newline = (char *)bufpool_get(new_size, &new_cap);
     if (newline == NULL) {
-      perror("line-buffer: memory allocation failed");
       return -1;
     }
+
+    // Claim the growth from the global budget before keeping it
+    long delta = new_cap - _line_buffer_heap_cap(buff);
+    long used = metrics_add(line_buffer_bytes, delta) + delta;
+    if (used > LINE_BUFFER_GLOBAL_BUDGET) {
+      metrics_add(line_buffer_bytes, -delta);
+      bufpool_put(newline, new_cap);
+      metrics_inc(line_buffer_budget_hits);
+      return _line_buffer_spill(buff, c, csz);
+    }
+    metrics_update_max(&metrics.line_buffer_bytes_peak, used);
+
     memcpy(newline, buff->line, buff->line_len);
-    if (buff->line != NULL) {
-        free(buff->line);
+    if (!_line_buffer_is_inline(buff)) {
+      bufpool_put(buff->line, buff->line_cap);
     }
     buff->line = newline;
-    buff->line_cap = reqd_cap;
+    buff->line_cap = new_cap;
   }
   memcpy(buff->line + buff->line_len, c, csz);
   buff->line_len = new_size;
@@ -55,5 +105,40 @@ int line_buffer_append(line_buffer_t *buff, char *c, size_t csz) {
 
 char *line_buffer_get(line_buffer_t *buff, ssize_t *len) {
   *len = buff->line_len;
-  return buff->line;
+  return line_buffer_spilled(buff) ? NULL : buff->line;
+}
+
+// Moves the line so far and the csz bytes at c to an anonymous file.
+// The memory of the line is kept for the next one.
+static ssize_t _line_buffer_spill(line_buffer_t *buff, char *c, size_t csz) {
+  int fd = open(LINE_BUFFER_SPILL_DIR, O_TMPFILE | O_RDWR | O_EXCL, 0600);
+  if (fd < 0) {
+    perror("line-buffer: failed to create spill file");
+    return -1;
+  }
+  if (_write_all(fd, buff->line, buff->line_len) < 0 || _write_all(fd, c, csz) < 0) {
+    close(fd);
+    return -1;
+  }
+  buff->spill_fd = fd;
+  buff->line_len += csz;
+  metrics_inc(spill_files_open);
+  metrics_add(spill_bytes, buff->line_len);
+  return buff->line_len;
+}
+
+static int _write_all(int fd, const char *c, size_t csz) {
+  while (csz > 0) {
+    ssize_t res = write(fd, c, csz);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("line-buffer: failed to write to spill file");
+      return -1;
+    }
+    c += res;
+    csz -= res;
+  }
+  return 0;
 }
@@ -2,22 +2,52 @@
 #define __AESDSOCKET_ASSIGNMENT_LINEBUFFER_H
 
 #include <stdio.h>
+#include <stdbool.h>
 
-/** 
+// A line is kept in memory until it needs more than the per connection
+// budget, or the line buffers of all connections together would go over
+// the global one. The rest of it then goes to an anonymous file in
+// LINE_BUFFER_SPILL_DIR, so a client sending a huge line without any
+// newline cannot run the daemon out of memory.
+#define LINE_BUFFER_CONN_BUDGET   (1024 * 1024)
+#define LINE_BUFFER_GLOBAL_BUDGET (64 * 1024 * 1024)
+#define LINE_BUFFER_SPILL_DIR     "/var/tmp"
+
+// Lines up to this size are kept in the line buffer itself, longer ones
+// in buffers from bufpool.h
+#define LINE_BUFFER_INLINE_SIZE   128
+
+/**
  * Line buffer abstracts keeping the line in memory. This is
  * important for handling long lines. It is a stripped down
  * version of the string type in C++ - a vector of chars.
+ *
+ * line points into the struct itself for short lines, so a line buffer
+ * must not be moved once initialized.
  */
 typedef struct line_buffer {
   char*  line;
   ssize_t line_len;
   ssize_t line_cap;
+  // Holds the whole line instead of line once it went over budget, -1 otherwise
+  int spill_fd;
+  char inline_line[LINE_BUFFER_INLINE_SIZE];
 }line_buffer_t;
 
 void line_buffer_init(line_buffer_t *buff);
 void line_buffer_clear(line_buffer_t *buff);
 void line_buffer_destroy(line_buffer_t *buff);
-int line_buffer_append(line_buffer_t *buff, char *c, size_t csz);
+ssize_t line_buffer_append(line_buffer_t *buff, char *c, size_t csz);
 char *line_buffer_get(line_buffer_t *buff, ssize_t *len);
 
-#endif
\ No newline at end of file
+// A spilled line is not in memory, line_buffer_get() returns NULL and
+// the line has to be read from the file returned here, from offset 0
+static inline bool line_buffer_spilled(const line_buffer_t *buff) {
+  return buff->spill_fd >= 0;
+}
+
+static inline int line_buffer_spill_fd(const line_buffer_t *buff) {
+  return buff->spill_fd;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "storage.h"
+#include "trace.h"
+
+#define MEMSTORE_SEGMENT_SIZE (1024 * 1024)
+
+// Keeps everything in memory, in a list of fixed size segments. Only
+// the last segment is ever written to and segments never move, so a
+// snapshot only needs the lock to read the current size and can send
+// the bytes up to it while appends carry on.
+typedef struct memstore_segment {
+  struct memstore_segment *next;
+  char data[MEMSTORE_SEGMENT_SIZE];
+}memstore_segment_t;
+
+typedef struct memstore {
+  pthread_mutex_t lock;
+  memstore_segment_t *head;
+  memstore_segment_t *tail;
+  size_t size;
+}memstore_t;
+
+static int memstore_open(storage_t *st) {
+  memstore_t *ms = (memstore_t *)calloc(1, sizeof(memstore_t));
+  if (ms == NULL) {
+    perror("failed to allocate memory store");
+    return -1;
+  }
+  pthread_mutex_init(&ms->lock, NULL);
+  st->priv = ms;
+  return 0;
+}
+
+// Returns where the next byte goes, with *room bytes free after it in
+// the tail segment, or NULL. Called with the lock held.
+static char *_memstore_tail(memstore_t *ms, size_t *room) {
+  size_t seg_offset = ms->size % MEMSTORE_SEGMENT_SIZE;
+  // The tail is full, or there is none yet
+  if (seg_offset == 0) {
+    memstore_segment_t *seg = (memstore_segment_t *)malloc(sizeof(memstore_segment_t));
+    if (seg == NULL) {
+      perror("failed to allocate memory store segment");
+      return NULL;
+    }
+    seg->next = NULL;
+    if (ms->tail == NULL) {
+      ms->head = seg;
+    } else {
+      ms->tail->next = seg;
+    }
+    ms->tail = seg;
+  }
+  *room = MEMSTORE_SEGMENT_SIZE - seg_offset;
+  return ms->tail->data + seg_offset;
+}
+
+static ssize_t memstore_append(storage_t *st, const char *data, size_t len) {
+  memstore_t *ms = (memstore_t *)st->priv;
+  size_t copied = 0;
+
+  pthread_mutex_lock(&ms->lock);
+  trace_mark(TRACE_LOCKED);
+  while (copied < len) {
+    size_t n;
+    char *dst = _memstore_tail(ms, &n);
+    if (dst == NULL) {
+      break;
+    }
+    if (n > len - copied) {
+      n = len - copied;
+    }
+    memcpy(dst, data + copied, n);
+    copied += n;
+    ms->size += n;
+  }
+  pthread_mutex_unlock(&ms->lock);
+  return copied > 0 || len == 0 ? (ssize_t)copied : -1;
+}
+
+// Reads the line straight into the segments, so that the only copy of
+// it in the heap is the one that is kept
+static ssize_t memstore_append_fd(storage_t *st, int fd, size_t len) {
+  memstore_t *ms = (memstore_t *)st->priv;
+  size_t copied = 0;
+
+  pthread_mutex_lock(&ms->lock);
+  trace_mark(TRACE_LOCKED);
+  while (copied < len) {
+    size_t n;
+    char *dst = _memstore_tail(ms, &n);
+    if (dst == NULL) {
+      break;
+    }
+    if (n > len - copied) {
+      n = len - copied;
+    }
+    ssize_t res = pread(fd, dst, n, copied);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      perror("failed to read the line to append");
+      break;
+    }
+    copied += res;
+    ms->size += res;
+  }
+  pthread_mutex_unlock(&ms->lock);
+  return copied > 0 || len == 0 ? (ssize_t)copied : -1;
+}
+
+static int memstore_send_snapshot(storage_t *st, int sockfd) {
+  memstore_t *ms = (memstore_t *)st->priv;
+
+  pthread_mutex_lock(&ms->lock);
+  size_t remaining = ms->size;
+  memstore_segment_t *seg = ms->head;
+  pthread_mutex_unlock(&ms->lock);
+
+  while (remaining > 0) {
+    size_t n = remaining < MEMSTORE_SEGMENT_SIZE ? remaining : MEMSTORE_SEGMENT_SIZE;
+    if (storage_send_all(sockfd, seg->data, n) < 0) {
+      return -1;
+    }
+    remaining -= n;
+    seg = seg->next;
+  }
+  return 0;
+}
+
+static void memstore_shutdown(storage_t *st) {
+  memstore_t *ms = (memstore_t *)st->priv;
+  while (ms->head != NULL) {
+    memstore_segment_t *seg = ms->head;
+    ms->head = seg->next;
+    free(seg);
+  }
+  pthread_mutex_destroy(&ms->lock);
+  free(ms);
+}
+
+const storage_ops_t memory_storage_ops = {
+  .name = "memory",
+  .default_path = NULL,
+  .open = memstore_open,
+  .append = memstore_append,
+  .append_fd = memstore_append_fd,
+  .send_snapshot = memstore_send_snapshot,
+  .shutdown = memstore_shutdown,
+};
@@ -0,0 +1,19 @@
+#include <stdatomic.h>
+#include <syslog.h>
+
+#include "metrics.h"
+
+metrics_t metrics;
+
+void metrics_update_max(atomic_long *counter, long v) {
+  long cur = atomic_load_explicit(counter, memory_order_relaxed);
+  while (cur < v && !atomic_compare_exchange_weak_explicit(counter, &cur, v,
+           memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+void metrics_dump() {
+#define METRICS_LOG_COUNTER(name) syslog(LOG_INFO, "metrics: %s %ld", #name, metrics_get(name));
+  METRICS_COUNTERS(METRICS_LOG_COUNTER)
+#undef METRICS_LOG_COUNTER
+}
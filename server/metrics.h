@@ -0,0 +1,43 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_METRICS_H
+#define __AESDSOCKET_ASSIGNMENT_METRICS_H
+
+#include <stdatomic.h>
+
+/**
+ * Process wide counters. They are updated with relaxed atomics from any
+ * thread and written to syslog on SIGUSR1. Add a counter by adding it to
+ * METRICS_COUNTERS, it is then dumped along with the others.
+ */
+#define METRICS_COUNTERS(X) \
+  X(line_buffer_bytes)       /* heap currently held by line buffers */ \
+  X(line_buffer_bytes_peak)  /* highest line_buffer_bytes so far */ \
+  X(line_buffer_budget_hits) /* lines that went over a budget */ \
+  X(lines_spilled)           /* lines that were stored from a spill file */ \
+  X(spill_bytes)             /* bytes written to spill files */ \
+  X(spill_files_open)        /* spill files currently open */ \
+  X(bufpool_allocs)          /* buffers the pool got from malloc */ \
+  X(bufpool_frees)           /* buffers the pool gave back to malloc */ \
+  X(bufpool_thread_hits)     /* buffers reused from the thread's cache */ \
+  X(bufpool_central_hits)    /* buffers reused from the central lists */ \
+  X(bufpool_misses)          /* requests the pool could not serve */ \
+  X(throttle_pauses)         /* times reading from a client was paused */ \
+  X(throttle_wait_us)        /* time spent in those pauses */
+
+typedef struct metrics {
+#define METRICS_DECLARE_COUNTER(name) atomic_long name;
+  METRICS_COUNTERS(METRICS_DECLARE_COUNTER)
+#undef METRICS_DECLARE_COUNTER
+}metrics_t;
+
+extern metrics_t metrics;
+
+#define metrics_add(name, v) atomic_fetch_add_explicit(&metrics.name, (v), memory_order_relaxed)
+#define metrics_inc(name)    metrics_add(name, 1)
+#define metrics_get(name)    atomic_load_explicit(&metrics.name, memory_order_relaxed)
+
+// Raises the counter to v if it is lower
+void metrics_update_max(atomic_long *counter, long v);
+
+void metrics_dump();
+
+#endif
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "storage.h"
+#include "appendcursor.h"
+#include "trace.h"
+
+// The whole window is mapped once up front, the file behind it is
+// preallocated an extent at a time as appends get close to its end
+#define MMAP_STORE_MAX_SIZE    ((size_t)1 << 30)
+#define MMAP_STORE_EXTENT_SIZE ((size_t)16 << 20)
+
+// Appends by copying into a shared mapping of the data file. Writers
+// reserve disjoint ranges through an append cursor and copy in parallel,
+// the only lock is taken when the file has to be grown. Replies are sent
+// straight from the mapping, up to the committed watermark.
+//
+// While running, the file is longer than its contents because of the
+// preallocation. On shutdown it is truncated to its true length and,
+// like with the file engine, removed unless kept for a hot restart.
+typedef struct mmap_store {
+  int fd;
+  char *map;
+  append_cursor_t cursor;
+  // Bytes of the file that are allocated and safe to touch through the map
+  atomic_size_t allocated;
+  pthread_mutex_t grow_lock;
+  // Start of the first range that could not be allocated, SIZE_MAX if
+  // none. Nothing at or past it is backed by the file, so it bounds what
+  // is sent and kept even though the cursor commits past it.
+  atomic_size_t failed_at;
+}mmap_store_t;
+
+static void _mmap_store_fail(mmap_store_t *ms, size_t start) {
+  size_t cur = atomic_load(&ms->failed_at);
+  while (start < cur && !atomic_compare_exchange_weak(&ms->failed_at, &cur, start)) {
+  }
+}
+
+// The end of the contents that are safe to read through the map
+static size_t _mmap_store_valid_end(mmap_store_t *ms) {
+  // The watermark is loaded first: a failed range moves failed_at before
+  // it is committed, so any range below the watermark is accounted for
+  size_t committed = append_cursor_committed(&ms->cursor);
+  size_t failed_at = atomic_load(&ms->failed_at);
+  return committed < failed_at ? committed : failed_at;
+}
+
+static int _mmap_store_grow(mmap_store_t *ms, size_t end) {
+  int err = 0;
+  pthread_mutex_lock(&ms->grow_lock);
+  size_t allocated = atomic_load(&ms->allocated);
+  if (allocated < end) {
+    size_t new_size = (end + MMAP_STORE_EXTENT_SIZE - 1) / MMAP_STORE_EXTENT_SIZE * MMAP_STORE_EXTENT_SIZE;
+    if (new_size > MMAP_STORE_MAX_SIZE) {
+      new_size = MMAP_STORE_MAX_SIZE;
+    }
+    // Unlike ftruncate() this reserves the blocks, so that running out
+    // of space is an error here instead of a SIGBUS in memcpy()
+    err = posix_fallocate(ms->fd, allocated, new_size - allocated);
+    if (err == 0) {
+      atomic_store(&ms->allocated, new_size);
+    }
+  }
+  pthread_mutex_unlock(&ms->grow_lock);
+  if (err != 0) {
+    errno = err;
+    perror("failed to preallocate the data file");
+    return -1;
+  }
+  return 0;
+}
+
+static int mmap_store_open(storage_t *st) {
+  mmap_store_t *ms = (mmap_store_t *)malloc(sizeof(mmap_store_t));
+  if (ms == NULL) {
+    perror("failed to allocate mmap store");
+    return -1;
+  }
+  ms->fd = open(st->path, O_CREAT | (st->resume ? 0 : O_TRUNC) | O_RDWR, 0666);
+  if (ms->fd == -1) {
+    perror("error while opening the output file");
+    goto free_store;
+  }
+  // A resumed file was truncated to its contents by the last shutdown
+  off_t size = lseek(ms->fd, 0, SEEK_END);
+  if (size < 0 || (size_t)size > MMAP_STORE_MAX_SIZE) {
+    fprintf(stderr, "cannot append to the %s data file\n", st->path);
+    goto close_file;
+  }
+  ms->map = mmap(NULL, MMAP_STORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ms->fd, 0);
+  if (ms->map == MAP_FAILED) {
+    perror("failed to map the data file");
+    goto close_file;
+  }
+  append_cursor_init(&ms->cursor, size);
+  atomic_init(&ms->allocated, size);
+  atomic_init(&ms->failed_at, SIZE_MAX);
+  pthread_mutex_init(&ms->grow_lock, NULL);
+  size_t headroom = MMAP_STORE_MAX_SIZE - size < MMAP_STORE_EXTENT_SIZE ? MMAP_STORE_MAX_SIZE - size : MMAP_STORE_EXTENT_SIZE;
+  if (_mmap_store_grow(ms, size + headroom) < 0) {
+    goto unmap;
+  }
+  st->priv = ms;
+  return 0;
+
+unmap:
+  pthread_mutex_destroy(&ms->grow_lock);
+  munmap(ms->map, MMAP_STORE_MAX_SIZE);
+close_file:
+  close(ms->fd);
+free_store:
+  free(ms);
+  return -1;
+}
+
+static ssize_t mmap_store_append(storage_t *st, const char *data, size_t len) {
+  mmap_store_t *ms = (mmap_store_t *)st->priv;
+  append_range_t r;
+
+  // Once a range is lost, anything after it would never be sent
+  if (atomic_load(&ms->failed_at) != SIZE_MAX ||
+      !append_cursor_reserve(&ms->cursor, len, MMAP_STORE_MAX_SIZE, &r)) {
+    errno = ENOSPC;
+    return -1;
+  }
+  trace_mark(TRACE_LOCKED);
+  if (atomic_load(&ms->allocated) < r.start + len && _mmap_store_grow(ms, r.start + len) < 0) {
+    // The range is still committed so that later appends can complete,
+    // but the store stops short of it from now on
+    _mmap_store_fail(ms, r.start);
+    append_cursor_commit(&ms->cursor, &r);
+    errno = ENOSPC;
+    return -1;
+  }
+  memcpy(ms->map + r.start, data, len);
+  append_cursor_commit(&ms->cursor, &r);
+  return len;
+}
+
+static int mmap_store_send_snapshot(storage_t *st, int sockfd) {
+  mmap_store_t *ms = (mmap_store_t *)st->priv;
+  return storage_send_all(sockfd, ms->map, _mmap_store_valid_end(ms));
+}
+
+static void mmap_store_shutdown(storage_t *st) {
+  mmap_store_t *ms = (mmap_store_t *)st->priv;
+  munmap(ms->map, MMAP_STORE_MAX_SIZE);
+  if (ftruncate(ms->fd, _mmap_store_valid_end(ms)) < 0) {
+    perror("failed to truncate the data file");
+  }
+  close(ms->fd);
+  if (!st->keep && unlink(st->path) < 0) {
+    perror("failed to delete the datafile");
+  }
+  pthread_mutex_destroy(&ms->grow_lock);
+  free(ms);
+}
+
+const storage_ops_t mmap_storage_ops = {
+  .name = "mmap",
+  .default_path = AESD_DATAFILE_PATH,
+  .open = mmap_store_open,
+  .append = mmap_store_append,
+  .send_snapshot = mmap_store_send_snapshot,
+  .shutdown = mmap_store_shutdown,
+};
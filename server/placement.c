@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "placement.h"
+
+#define CPU_LIST_BUFFER_SIZE 256
+
+typedef struct placement {
+  bool pin_loop;
+  bool pin_workers;
+  cpu_set_t loop_cpus;
+  cpu_set_t worker_cpus;
+  size_t worker_stack_size;
+  // set_mempolicy() is not there without NUMA support
+  bool local_memory;
+}placement_t;
+
+static placement_t placement;
+
+// Parses a list like "0-3,6" into set, within the CPUs the process may
+// run on. Returns -1 if it is malformed or leaves no CPU.
+static int _placement_parse_cpus(const char *list, cpu_set_t *set) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return -1;
+  }
+  CPU_ZERO(set);
+
+  const char *p = list;
+  while (*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0) {
+      return -1;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return -1;
+      }
+    }
+    if (last >= CPU_SETSIZE) {
+      return -1;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    if (*end == ',') {
+      end++;
+    } else if (*end != '\0') {
+      return -1;
+    }
+    p = end;
+  }
+  CPU_AND(set, set, &allowed);
+  return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static void _placement_format_cpus(const cpu_set_t *set, char *buf, size_t len) {
+  size_t used = 0;
+  buf[0] = '\0';
+  for (int cpu = 0; cpu < CPU_SETSIZE && used < len; cpu++) {
+    if (!CPU_ISSET(cpu, set)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+      last++;
+    }
+    if (last == cpu) {
+      used += snprintf(buf + used, len - used, "%s%d", used > 0 ? "," : "", cpu);
+    } else {
+      used += snprintf(buf + used, len - used, "%s%d-%d", used > 0 ? "," : "", cpu, last);
+    }
+    cpu = last;
+  }
+}
+
+static void _placement_set_local_memory() {
+  if (placement.local_memory && syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) != 0) {
+    perror("failed to set the local memory policy");
+  }
+}
+
+void placement_init(const placement_config_t *config) {
+  if (config->loop_cpus != NULL) {
+    if (_placement_parse_cpus(config->loop_cpus, &placement.loop_cpus) < 0) {
+      fprintf(stderr, "invalid or unavailable event loop CPUs %s\n", config->loop_cpus);
+      exit(EXIT_FAILURE);
+    }
+    placement.pin_loop = true;
+  }
+  if (config->worker_cpus != NULL) {
+    if (_placement_parse_cpus(config->worker_cpus, &placement.worker_cpus) < 0) {
+      fprintf(stderr, "invalid or unavailable worker CPUs %s\n", config->worker_cpus);
+      exit(EXIT_FAILURE);
+    }
+    placement.pin_workers = true;
+  }
+  if (config->worker_stack_size != 0 && config->worker_stack_size < PLACEMENT_MIN_STACK_SIZE) {
+    fprintf(stderr, "worker stack size must be at least %zu bytes\n", PLACEMENT_MIN_STACK_SIZE);
+    exit(EXIT_FAILURE);
+  }
+  placement.worker_stack_size = config->worker_stack_size;
+  placement.local_memory = syscall(SYS_get_mempolicy, NULL, NULL, 0, NULL, 0) == 0;
+}
+
+void placement_report() {
+  char buf[CPU_LIST_BUFFER_SIZE];
+  pthread_attr_t attr;
+  size_t stack_size = placement.worker_stack_size;
+
+  if (stack_size == 0 && pthread_attr_init(&attr) == 0) {
+    pthread_attr_getstacksize(&attr, &stack_size);
+    pthread_attr_destroy(&attr);
+  }
+
+  _placement_format_cpus(&placement.loop_cpus, buf, CPU_LIST_BUFFER_SIZE);
+  syslog(LOG_INFO, "Placement: event loop on CPUs %s", placement.pin_loop ? buf : "any");
+  _placement_format_cpus(&placement.worker_cpus, buf, CPU_LIST_BUFFER_SIZE);
+  syslog(LOG_INFO, "Placement: workers on CPUs %s, %zu KiB stacks", placement.pin_workers ? buf : "any",
+    stack_size / 1024);
+  syslog(LOG_INFO, "Placement: memory %s", placement.local_memory ? "on the local NUMA node" : "without NUMA policy");
+}
+
+void placement_apply_loop() {
+  if (placement.pin_loop) {
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &placement.loop_cpus);
+    if (err != 0) {
+      errno = err;
+      perror("failed to pin the event loop");
+    }
+  }
+  _placement_set_local_memory();
+}
+
+void placement_apply_worker() {
+  _placement_set_local_memory();
+}
+
+void placement_worker_attr(pthread_attr_t *attr) {
+  // A thread created pinned never runs, nor first touches its stack,
+  // anywhere else
+  if (placement.pin_workers) {
+    pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &placement.worker_cpus);
+  }
+  if (placement.worker_stack_size != 0) {
+    pthread_attr_setstacksize(attr, placement.worker_stack_size);
+  }
+}
+
+size_t placement_worker_stack_size() {
+  return placement.worker_stack_size;
+}
+
+size_t placement_parse_size(const char *arg) {
+  char *end;
+  unsigned long long size = strtoull(arg, &end, 10);
+  if (end == arg) {
+    return 0;
+  }
+  if (*end == 'K' || *end == 'k') {
+    size *= 1024;
+    end++;
+  } else if (*end == 'M' || *end == 'm') {
+    size *= 1024 * 1024;
+    end++;
+  }
+  return *end == '\0' ? size : 0;
+}
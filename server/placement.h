@@ -0,0 +1,50 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_PLACEMENT_H
+#define __AESDSOCKET_ASSIGNMENT_PLACEMENT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Where the threads of the server run. The event loop thread accepts
+ * connections and writes the timestamps, worker threads serve one
+ * connection each and append its lines. Either can be pinned to a set of
+ * CPUs given as a list like "0-3,6".
+ *
+ * Threads also ask the kernel to allocate their memory on the NUMA node
+ * they are running on. Their stacks, line buffers and buffer pool caches
+ * are first touched by the threads themselves, so pinned threads keep
+ * them on their node.
+ */
+typedef struct placement_config {
+  // NULL to leave the threads to the scheduler
+  const char *loop_cpus;
+  const char *worker_cpus;
+  // 0 for the default of the C library. With coroutines it sizes the
+  // stack of each of them, 0 then being CORO_DEFAULT_STACK_SIZE.
+  size_t worker_stack_size;
+}placement_config_t;
+
+#define PLACEMENT_MIN_STACK_SIZE ((size_t)64 * 1024)
+
+// Checks the config and remembers it. Exits if it is invalid.
+void placement_init(const placement_config_t *config);
+
+// Logs the placement in effect
+void placement_report();
+
+// Places the calling thread as the event loop
+void placement_apply_loop();
+
+// Called by each worker thread as it starts
+void placement_apply_worker();
+
+// Fills in the attributes worker threads are created with
+void placement_worker_attr(pthread_attr_t *attr);
+
+// The stack size asked for the workers, 0 if none was
+size_t placement_worker_stack_size();
+
+// Parses a size with an optional K or M suffix, 0 if it is invalid
+size_t placement_parse_size(const char *arg);
+
+#endif
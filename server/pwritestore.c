@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "storage.h"
+#include "appendcursor.h"
+#include "trace.h"
+
+#define SENDFILE_CHUNK_SIZE (64 * 1024)
+
+// Like the file engine, but appends do not serialize on a lock. Each of
+// them claims its offset with a fetch-add on an append cursor and then
+// pwrite()s it, in parallel with the others. The file must not be opened
+// with O_APPEND, which would make pwrite() ignore the offset. Replies
+// only send the committed prefix, so they never include a range whose
+// write has not finished yet. Once a write fails the store stops short
+// of it, as the mmap engine does, rather than sending the hole it left.
+typedef struct pwrite_store {
+  int fd;
+  append_cursor_t cursor;
+  // Start of the first range whose write failed, SIZE_MAX if none did
+  atomic_size_t failed_at;
+}pwrite_store_t;
+
+static void _pwrite_store_fail(pwrite_store_t *ps, size_t start) {
+  size_t cur = atomic_load(&ps->failed_at);
+  while (start < cur && !atomic_compare_exchange_weak(&ps->failed_at, &cur, start)) {
+  }
+}
+
+// The end of the contents that are complete in the file
+static size_t _pwrite_store_valid_end(pwrite_store_t *ps) {
+  // The watermark is loaded first: a failed range moves failed_at before
+  // it is committed, so any range below the watermark is accounted for
+  size_t committed = append_cursor_committed(&ps->cursor);
+  size_t failed_at = atomic_load(&ps->failed_at);
+  return committed < failed_at ? committed : failed_at;
+}
+
+static int pwrite_store_open(storage_t *st) {
+  pwrite_store_t *ps = (pwrite_store_t *)malloc(sizeof(pwrite_store_t));
+  if (ps == NULL) {
+    perror("failed to allocate pwrite store");
+    return -1;
+  }
+  ps->fd = open(st->path, O_CREAT | (st->resume ? 0 : O_TRUNC) | O_RDWR, 0666);
+  if (ps->fd == -1) {
+    perror("error while opening the output file");
+    free(ps);
+    return -1;
+  }
+  off_t size = lseek(ps->fd, 0, SEEK_END);
+  if (size < 0) {
+    perror("error while sizing the output file");
+    close(ps->fd);
+    free(ps);
+    return -1;
+  }
+  append_cursor_init(&ps->cursor, size);
+  atomic_init(&ps->failed_at, SIZE_MAX);
+  st->priv = ps;
+  return 0;
+}
+
+static ssize_t pwrite_store_append(storage_t *st, const char *data, size_t len) {
+  pwrite_store_t *ps = (pwrite_store_t *)st->priv;
+  if (atomic_load(&ps->failed_at) != SIZE_MAX) {
+    errno = EIO;
+    return -1;
+  }
+  append_range_t r = append_cursor_reserve_unbounded(&ps->cursor, len);
+  trace_mark(TRACE_LOCKED);
+  size_t written = 0;
+  int err = 0;
+
+  while (written < len) {
+    ssize_t res = pwrite(ps->fd, data + written, len - written, r.start + written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err = errno;
+      break;
+    }
+    written += res;
+  }
+  // Committed even if the write failed, or the watermark would never
+  // move past it, but the store stops short of it from now on
+  if (err != 0) {
+    _pwrite_store_fail(ps, r.start);
+  }
+  append_cursor_commit(&ps->cursor, &r);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return len;
+}
+
+static ssize_t pwrite_store_append_fd(storage_t *st, int fd, size_t len) {
+  pwrite_store_t *ps = (pwrite_store_t *)st->priv;
+  if (atomic_load(&ps->failed_at) != SIZE_MAX) {
+    errno = EIO;
+    return -1;
+  }
+  append_range_t r = append_cursor_reserve_unbounded(&ps->cursor, len);
+  trace_mark(TRACE_LOCKED);
+  int res = storage_copy_fd_range(fd, ps->fd, r.start, len);
+  if (res < 0) {
+    int err = errno;
+    _pwrite_store_fail(ps, r.start);
+    errno = err;
+  }
+  append_cursor_commit(&ps->cursor, &r);
+  return res < 0 ? -1 : (ssize_t)len;
+}
+
+static int pwrite_store_send_snapshot(storage_t *st, int sockfd) {
+  pwrite_store_t *ps = (pwrite_store_t *)st->priv;
+  off_t fileoffset = 0;
+  size_t committed = _pwrite_store_valid_end(ps);
+
+  while ((size_t)fileoffset < committed) {
+    size_t count = committed - fileoffset;
+    if (count > SENDFILE_CHUNK_SIZE) {
+      count = SENDFILE_CHUNK_SIZE;
+    }
+    ssize_t res = sendfile(sockfd, ps->fd, &fileoffset, count);
+    if (res < 0 && storage_send_retry(sockfd)) {
+      continue;
+    }
+    if (res < 0) {
+      perror("error while sending file output to socket");
+      return -1;
+    }
+    if (res == 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
+static void pwrite_store_shutdown(storage_t *st) {
+  pwrite_store_t *ps = (pwrite_store_t *)st->priv;
+  // Drop a failed write and whatever came after it, so that a hot
+  // restart does not resume past a hole
+  if (atomic_load(&ps->failed_at) != SIZE_MAX && ftruncate(ps->fd, _pwrite_store_valid_end(ps)) < 0) {
+    perror("failed to truncate the data file");
+  }
+  close(ps->fd);
+  if (!st->keep && unlink(st->path) < 0) {
+    perror("failed to delete the datafile");
+  }
+  free(ps);
+}
+
+const storage_ops_t pwrite_storage_ops = {
+  .name = "pwrite",
+  .default_path = AESD_DATAFILE_PATH,
+  .open = pwrite_store_open,
+  .append = pwrite_store_append,
+  .append_fd = pwrite_store_append_fd,
+  .send_snapshot = pwrite_store_send_snapshot,
+  .shutdown = pwrite_store_shutdown,
+};
@@ -0,0 +1,33 @@
+#include <time.h>
+
+#include "ratelimit.h"
+
+void rate_limiter_init(rate_limiter_t *r, long per_sec) {
+  r->token_ns = per_sec > 0 ? (RATE_LIMIT_NSEC_PER_SEC + per_sec - 1) / per_sec : 0;
+  atomic_init(&r->full_at_ns, 0);
+}
+
+uint64_t rate_limiter_take(rate_limiter_t *r, uint64_t n, uint64_t now_ns) {
+  if (!rate_limiter_enabled(r)) {
+    return 0;
+  }
+  uint64_t cost = n * r->token_ns;
+  uint64_t full_at = atomic_load_explicit(&r->full_at_ns, memory_order_relaxed);
+  uint64_t new_full_at;
+  do {
+    // A bucket that has been full for a while is not any fuller
+    new_full_at = (full_at > now_ns ? full_at : now_ns) + cost;
+  } while (!atomic_compare_exchange_weak_explicit(&r->full_at_ns, &full_at, new_full_at,
+             memory_order_relaxed, memory_order_relaxed));
+
+  // The bucket holds a second's worth, it is empty once it would take
+  // longer than that to fill up again
+  uint64_t empty_at = new_full_at - RATE_LIMIT_NSEC_PER_SEC;
+  return new_full_at > RATE_LIMIT_NSEC_PER_SEC && empty_at > now_ns ? empty_at - now_ns : 0;
+}
+
+uint64_t rate_limiter_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * RATE_LIMIT_NSEC_PER_SEC + ts.tv_nsec;
+}
@@ -0,0 +1,40 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_RATELIMIT_H
+#define __AESDSOCKET_ASSIGNMENT_RATELIMIT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RATE_LIMIT_NSEC_PER_SEC 1000000000ULL
+
+/**
+ * A token bucket refilling at a fixed rate per second and holding up to
+ * a second's worth of tokens. Rather than a token count it keeps the
+ * time at which the bucket will be full again, so a take is a single
+ * compare and swap and one limiter can be shared by every connection.
+ *
+ * A take always succeeds, even for more than the bucket holds. The
+ * caller is told how long to wait before taking again, so one oversized
+ * line goes through and the time it costs is paid afterwards.
+ */
+typedef struct rate_limiter {
+  // Cost of a single token, 0 if there is no limit
+  uint64_t token_ns;
+  // The bucket is full again at this time on the monotonic clock
+  atomic_uint_fast64_t full_at_ns;
+}rate_limiter_t;
+
+// A rate of 0 means no limit
+void rate_limiter_init(rate_limiter_t *r, long per_sec);
+
+// Takes n tokens. Returns how many nanoseconds the caller should wait
+// before taking more, 0 while the bucket is not empty.
+uint64_t rate_limiter_take(rate_limiter_t *r, uint64_t n, uint64_t now_ns);
+
+uint64_t rate_limiter_now_ns();
+
+static inline bool rate_limiter_enabled(const rate_limiter_t *r) {
+  return r->token_ns != 0;
+}
+
+#endif
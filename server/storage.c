@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "storage.h"
+#include "coroutine.h"
+
+const storage_ops_t *storage_engines[] = {
+  &file_storage_ops,
+  &chardev_storage_ops,
+  &memory_storage_ops,
+  &mmap_storage_ops,
+  &pwrite_storage_ops,
+  NULL,
+};
+
+const storage_ops_t *storage_find_engine(const char *name) {
+  for (int i = 0; storage_engines[i] != NULL; i++) {
+    if (strcmp(storage_engines[i]->name, name) == 0) {
+      return storage_engines[i];
+    }
+  }
+  return NULL;
+}
+
+void storage_print_engines(FILE *f) {
+  for (int i = 0; storage_engines[i] != NULL; i++) {
+    fprintf(f, "%s%s", i > 0 ? ", " : "", storage_engines[i]->name);
+  }
+  fprintf(f, "\n");
+}
+
+storage_t *storage_open(const storage_ops_t *ops, const char *path, bool resume) {
+  storage_t *st = (storage_t *)calloc(1, sizeof(storage_t));
+  if (st == NULL) {
+    perror("failed to allocate storage");
+    return NULL;
+  }
+  st->ops = ops;
+  st->path = path != NULL ? path : ops->default_path;
+  st->resume = resume;
+  if (ops->open(st) < 0) {
+    free(st);
+    return NULL;
+  }
+  return st;
+}
+
+void storage_close(storage_t *st) {
+  st->ops->shutdown(st);
+  free(st);
+}
+
+int storage_send_all(int sockfd, const char *buf, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t res = send(sockfd, buf + sent, len - sent, MSG_NOSIGNAL);
+    if (res < 0 && storage_send_retry(sockfd)) {
+      continue;
+    }
+    if (res < 0) {
+      perror("error while sending storage contents to socket");
+      return -1;
+    }
+    sent += res;
+  }
+  return 0;
+}
+
+bool storage_send_retry(int sockfd) {
+  if (errno == EINTR) {
+    return true;
+  }
+  return errno == EAGAIN && coro_wait_fd(sockfd, POLLOUT, -1) > 0;
+}
+
+// Engines without append_fd() get the bytes through a read only mapping
+// of the file. They are still appended in one go, and backed by the page
+// cache instead of the heap, unless the engine copies them into memory of
+// its own. Those engines set max_fd_append.
+ssize_t storage_append_fd(storage_t *st, int fd, size_t len) {
+  if (st->ops->append_fd != NULL) {
+    return st->ops->append_fd(st, fd, len);
+  }
+  if (len == 0) {
+    return 0;
+  }
+  if (st->ops->max_fd_append != 0 && len > st->ops->max_fd_append) {
+    fprintf(stderr, "a line of %zu bytes is too long for the %s storage\n", len, st->ops->name);
+    errno = EFBIG;
+    return -1;
+  }
+  char *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror("failed to map the file to append");
+    return -1;
+  }
+  ssize_t res = storage_append(st, data, len);
+  munmap(data, len);
+  return res;
+}
+
+int storage_copy_fd_range(int in_fd, int out_fd, off_t out_offset, size_t len) {
+  off_t in_offset = 0;
+
+  // copy_file_range() lets the filesystem copy or share the blocks
+  // without going through userspace
+  while (len > 0) {
+    ssize_t res = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, len, 0);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+        break;
+      }
+      perror("failed to copy into the storage");
+      return -1;
+    }
+    if (res == 0) {
+      break;
+    }
+    len -= res;
+  }
+
+  // Not supported between these files, or the input was shorter than
+  // expected, which the read below will tell
+  char buf[STORAGE_COPY_CHUNK_SIZE];
+  while (len > 0) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    ssize_t bytes_read = pread(in_fd, buf, n, in_offset);
+    if (bytes_read <= 0) {
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      perror("failed to read the file to copy");
+      return -1;
+    }
+    for (ssize_t written = 0; written < bytes_read; ) {
+      ssize_t res = pwrite(out_fd, buf + written, bytes_read - written, out_offset);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("failed to copy into the storage");
+        return -1;
+      }
+      written += res;
+      out_offset += res;
+    }
+    in_offset += bytes_read;
+    len -= bytes_read;
+  }
+  return 0;
+}
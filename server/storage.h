@@ -0,0 +1,100 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_STORAGE_H
+#define __AESDSOCKET_ASSIGNMENT_STORAGE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define AESD_DATAFILE_PATH "/var/tmp/aesdsocketdata"
+#define AESD_CHARDEV_PATH  "/dev/aesdchar"
+
+// Build with USE_AESD_CHAR_DEVICE=1 to store into AESD_CHARDEV_PATH
+// instead of AESD_DATAFILE_PATH by default. Any engine can still be
+// picked at run time.
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE 0
+#endif
+
+#if USE_AESD_CHAR_DEVICE
+#define AESD_DEFAULT_STORAGE_OPS chardev_storage_ops
+#else
+#define AESD_DEFAULT_STORAGE_OPS file_storage_ops
+#endif
+
+struct storage;
+
+/**
+ * Operations of a storage engine. Every received line and timestamp is
+ * appended to the storage, and after each line the whole storage is sent
+ * back to the client. Both can be called concurrently from any number of
+ * connection threads, so engines do their own locking.
+ */
+typedef struct storage_ops {
+  const char *name;
+  // Used when no path is given to storage_open(), NULL if the engine
+  // keeps everything in memory
+  const char *default_path;
+  int (*open)(struct storage *st);
+  // Returns the number of bytes appended or -1 with errno set
+  ssize_t (*append)(struct storage *st, const char *data, size_t len);
+  // Appends len bytes read from fd, starting at offset 0, as a single
+  // entry without bringing them into the heap. Optional, see
+  // storage_append_fd()
+  ssize_t (*append_fd)(struct storage *st, int fd, size_t len);
+  // Longest line storage_append_fd() hands to append() when there is no
+  // append_fd(), 0 for no limit
+  size_t max_fd_append;
+  // Sends everything appended so far to sockfd. Returns 0 or -1
+  int (*send_snapshot)(struct storage *st, int sockfd);
+  // Releases whatever open() set up. No other operation may be running
+  // or be called afterwards, except for send_snapshot() failing.
+  void (*shutdown)(struct storage *st);
+}storage_ops_t;
+
+typedef struct storage {
+  const storage_ops_t *ops;
+  const char *path;
+  // Appends go after whatever the data file already holds instead of
+  // starting from an empty one. Engines without a data file start empty.
+  bool resume;
+  // Set before storage_close() to leave the data file in place for the
+  // next process, as on a hot restart
+  bool keep;
+  void *priv;
+}storage_t;
+
+extern const storage_ops_t file_storage_ops;
+extern const storage_ops_t chardev_storage_ops;
+extern const storage_ops_t memory_storage_ops;
+extern const storage_ops_t mmap_storage_ops;
+extern const storage_ops_t pwrite_storage_ops;
+
+// NULL terminated list of all the engines
+extern const storage_ops_t *storage_engines[];
+
+const storage_ops_t *storage_find_engine(const char *name);
+storage_t *storage_open(const storage_ops_t *ops, const char *path, bool resume);
+void storage_close(storage_t *st);
+void storage_print_engines(FILE *f);
+
+int storage_send_all(int sockfd, const char *buf, size_t len);
+
+// Client sockets served by coroutines are non-blocking. Called after a
+// send to sockfd failed, returns true once it makes sense to send again.
+bool storage_send_retry(int sockfd);
+ssize_t storage_append_fd(storage_t *st, int fd, size_t len);
+
+// Copies len bytes from offset 0 of in_fd to out_offset of out_fd, which
+// must not be opened with O_APPEND. For engines implementing append_fd().
+#define STORAGE_COPY_CHUNK_SIZE (16 * 1024)
+int storage_copy_fd_range(int in_fd, int out_fd, off_t out_offset, size_t len);
+
+static inline ssize_t storage_append(storage_t *st, const char *data, size_t len) {
+  return st->ops->append(st, data, len);
+}
+
+static inline int storage_send_snapshot(storage_t *st, int sockfd) {
+  return st->ops->send_snapshot(st, sockfd);
+}
+
+#endif
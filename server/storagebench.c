@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "storagebench.h"
+
+#define BENCH_LINES_PER_THREAD  20000
+#define BENCH_LINE_SIZE         64
+#define BENCH_SNAPSHOT_EVERY    2000
+// File backed engines are benchmarked on a file of their own, so that a
+// server running next to the benchmark keeps its data
+#define BENCH_PATH_TEMPLATE     "/var/tmp/aesdsocketbench-XXXXXX"
+
+typedef struct bench_worker {
+  pthread_t thread;
+  pthread_t drain_thread;
+  storage_t *st;
+  int sockfds[2];
+  int failed;
+}bench_worker_t;
+
+static double now_secs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Stands in for the client, reading and discarding the snapshots
+static void *_bench_drain(void *a) {
+  bench_worker_t *w = (bench_worker_t *)a;
+  char buf[64 * 1024];
+  while (read(w->sockfds[1], buf, sizeof(buf)) > 0) {
+  }
+  return NULL;
+}
+
+static void *_bench_work(void *a) {
+  bench_worker_t *w = (bench_worker_t *)a;
+  char line[BENCH_LINE_SIZE];
+
+  memset(line, 'x', BENCH_LINE_SIZE - 1);
+  line[BENCH_LINE_SIZE - 1] = '\n';
+  for (int i = 1; i <= BENCH_LINES_PER_THREAD; i++) {
+    if (storage_append(w->st, line, BENCH_LINE_SIZE) != BENCH_LINE_SIZE) {
+      w->failed = 1;
+      break;
+    }
+    if (i % BENCH_SNAPSHOT_EVERY == 0 && storage_send_snapshot(w->st, w->sockfds[0]) < 0) {
+      w->failed = 1;
+      break;
+    }
+  }
+  shutdown(w->sockfds[0], SHUT_WR);
+  return NULL;
+}
+
+static int _bench_engine(const storage_ops_t *ops, int nthreads) {
+  bench_worker_t *workers = (bench_worker_t *)calloc(nthreads, sizeof(bench_worker_t));
+  int failed = 0;
+
+  if (workers == NULL) {
+    perror("bench: failed to allocate workers");
+    return -1;
+  }
+  char path[] = BENCH_PATH_TEMPLATE;
+  bool temp_path = ops->default_path != NULL && ops != &chardev_storage_ops;
+  if (temp_path) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+      perror("bench: failed to create a data file");
+      free(workers);
+      return -1;
+    }
+    close(fd);
+  }
+  storage_t *st = storage_open(ops, temp_path ? path : NULL, false);
+  if (st == NULL) {
+    printf("%-10s unavailable\n", ops->name);
+    if (temp_path) {
+      unlink(path);
+    }
+    free(workers);
+    return 0;
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    workers[i].st = st;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, workers[i].sockfds) < 0) {
+      perror("bench: socketpair failed");
+      exit(EXIT_FAILURE);
+    }
+    pthread_create(&workers[i].drain_thread, NULL, _bench_drain, &workers[i]);
+  }
+
+  double start = now_secs();
+  for (int i = 0; i < nthreads; i++) {
+    pthread_create(&workers[i].thread, NULL, _bench_work, &workers[i]);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    failed |= workers[i].failed;
+  }
+  double elapsed = now_secs() - start;
+
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].drain_thread, NULL);
+    close(workers[i].sockfds[0]);
+    close(workers[i].sockfds[1]);
+  }
+  storage_close(st);
+  // Not every engine removes its file on shutdown
+  if (temp_path) {
+    unlink(path);
+  }
+  free(workers);
+
+  long lines = (long)nthreads * BENCH_LINES_PER_THREAD;
+  printf("%-10s %8d %12.0f %12.1f %10.3f%s\n", ops->name, nthreads, lines / elapsed,
+    lines * BENCH_LINE_SIZE / elapsed / (1024 * 1024), elapsed, failed ? " (failed)" : "");
+  return failed ? -1 : 0;
+}
+
+int storage_bench_run(const storage_ops_t *only, int nthreads) {
+  int retval = 0;
+
+  printf("%-10s %8s %12s %12s %10s\n", "engine", "threads", "lines/s", "MiB/s", "secs");
+  for (int i = 0; storage_engines[i] != NULL; i++) {
+    if (only != NULL && storage_engines[i] != only) {
+      continue;
+    }
+    // The device is shared with any server using it and cleared on open
+    if (only == NULL && storage_engines[i] == &chardev_storage_ops) {
+      printf("%-10s skipped, select it with -s to benchmark it\n", storage_engines[i]->name);
+      continue;
+    }
+    if (_bench_engine(storage_engines[i], nthreads) < 0) {
+      retval = -1;
+    }
+  }
+  return retval;
+}
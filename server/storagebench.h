@@ -0,0 +1,19 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_STORAGEBENCH_H
+#define __AESDSOCKET_ASSIGNMENT_STORAGEBENCH_H
+
+#include "storage.h"
+
+#define STORAGE_BENCH_DEFAULT_THREADS 4
+
+/**
+ * Runs the same workload against the engine given, or against every
+ * engine if it is NULL, and prints the results. Each thread appends
+ * lines like a client connection and sends a snapshot every so often,
+ * into a socket that is drained and discarded. File backed engines run
+ * on a temporary file. The char device is only benchmarked when it is
+ * the engine given, as opening it clears it for every user. Engines
+ * that cannot be opened (e.g. no /dev/aesdchar) are reported and skipped.
+ */
+int storage_bench_run(const storage_ops_t *only, int nthreads);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+atomic_bool trace_enabled;
+__thread trace_record_t *trace_current;
+
+static trace_record_t *ring;
+static size_t ring_size;
+// Number of records ever committed, the next one goes to next % ring_size
+static atomic_uint_fast64_t next;
+
+int trace_init(size_t nr_records) {
+  ring = (trace_record_t *)calloc(nr_records, sizeof(trace_record_t));
+  if (ring == NULL) {
+    perror("trace: failed to allocate the ring");
+    return -1;
+  }
+  ring_size = nr_records;
+  atomic_init(&next, 0);
+  atomic_store(&trace_enabled, true);
+  return 0;
+}
+
+// The seq of a slot works like a seqlock: it is cleared while the slot
+// is written and then set to the record's position, so a dump running
+// at the same time can tell a torn copy and skip it
+void trace_commit(const trace_record_t *r) {
+  uint64_t pos = atomic_fetch_add_explicit(&next, 1, memory_order_relaxed);
+  trace_record_t *slot = &ring[pos % ring_size];
+
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->conn = r->conn;
+  slot->line_len = r->line_len;
+  memcpy(slot->ts, r->ts, sizeof(slot->ts));
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+// The dump is written to a new file next to path and renamed over it.
+// mkstemp() never follows a link planted at its name, and rename()
+// replaces a link at path rather than writing through it.
+int trace_dump(const char *path) {
+  if (ring == NULL) {
+    fprintf(stderr, "trace: tracing is not enabled\n");
+    return -1;
+  }
+  size_t tmp_size = strlen(path) + sizeof(".XXXXXX");
+  char *tmp_path = (char *)malloc(tmp_size);
+  if (tmp_path == NULL) {
+    perror("trace: failed to allocate the dump path");
+    return -1;
+  }
+  snprintf(tmp_path, tmp_size, "%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (f == NULL) {
+    perror("trace: failed to create the dump");
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_path);
+    }
+    free(tmp_path);
+    return -1;
+  }
+
+  uint64_t end = atomic_load_explicit(&next, memory_order_acquire);
+  uint64_t start = end > ring_size ? end - ring_size : 0;
+  trace_file_header_t header = {
+    .nr_stages = TRACE_NR_STAGES,
+    .record_size = sizeof(uint64_t) * (2 + TRACE_NR_STAGES),
+  };
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  // The count is filled in once the records that were torn are known
+  fwrite(&header, sizeof(header), 1, f);
+
+  for (uint64_t pos = start; pos < end; pos++) {
+    trace_record_t *slot = &ring[pos % ring_size];
+    uint64_t out[2 + TRACE_NR_STAGES];
+
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    out[0] = slot->conn;
+    out[1] = slot->line_len;
+    memcpy(&out[2], slot->ts, sizeof(slot->ts));
+    atomic_thread_fence(memory_order_acquire);
+    if (seq != pos + 1 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+      continue;
+    }
+    fwrite(out, sizeof(out), 1, f);
+    header.count++;
+  }
+
+  rewind(f);
+  fwrite(&header, sizeof(header), 1, f);
+  int retval = 0;
+  if (fclose(f) != 0) {
+    perror("trace: failed to write the dump");
+    retval = -1;
+  } else if (rename(tmp_path, path) != 0) {
+    perror("trace: failed to move the dump in place");
+    retval = -1;
+  }
+  if (retval < 0) {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return retval;
+}
@@ -0,0 +1,83 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_TRACE_H
+#define __AESDSOCKET_ASSIGNMENT_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Per line latency tracing. When enabled, every line a client sends
+ * leaves a record in a ring with the time it reached each stage of the
+ * pipeline. The ring is written to TRACE_DUMP_PATH, or the path given
+ * with -T, on SIGUSR2, and tracehist turns the dump into per stage
+ * latency histograms.
+ *
+ * Tracing is off unless the ring is set up with trace_init(). While it
+ * is off, each trace point costs a relaxed load and a branch.
+ */
+#define TRACE_DUMP_PATH "/var/tmp/aesdsocket.trace"
+#define TRACE_MAGIC     "AESDTRC1"
+
+typedef enum trace_stage {
+  TRACE_RECV,      // read() returned the end of the line
+  TRACE_FRAMED,    // the newline was found
+  TRACE_LOCKED,    // the storage engine got its lock or reserved its range
+  TRACE_APPENDED,  // the append returned
+  TRACE_REPLIED,   // the reply was sent in full
+  TRACE_NR_STAGES,
+}trace_stage_t;
+
+// Stages a record did not go through, e.g. TRACE_LOCKED with engines
+// that do not report it, are 0
+typedef struct trace_record {
+  // Written last, 0 while the record is being filled in
+  atomic_uint_fast64_t seq;
+  uint64_t conn;
+  uint64_t line_len;
+  uint64_t ts[TRACE_NR_STAGES];
+}trace_record_t;
+
+// The dump is this header followed by count records of record_size
+// bytes: conn, line_len and the stage times in ns on the monotonic
+// clock, all 64 bit in host byte order
+typedef struct trace_file_header {
+  char magic[8];
+  uint32_t nr_stages;
+  uint32_t record_size;
+  uint64_t count;
+}trace_file_header_t;
+
+extern atomic_bool trace_enabled;
+
+// The record of the line the calling thread is appending, for storage
+// engines to stamp TRACE_LOCKED into. NULL when not tracing.
+extern __thread trace_record_t *trace_current;
+
+static inline bool trace_on() {
+  return __builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0);
+}
+
+static inline uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void trace_mark(trace_stage_t stage) {
+  if (trace_on() && trace_current != NULL) {
+    trace_current->ts[stage] = trace_now();
+  }
+}
+
+// Sets up a ring of nr_records and turns tracing on. Returns 0 or -1.
+int trace_init(size_t nr_records);
+
+// Copies a finished record into the ring, overwriting the oldest one
+void trace_commit(const trace_record_t *r);
+
+// Writes the records in the ring to path, oldest first, replacing
+// whatever is there. Returns 0 or -1.
+int trace_dump(const char *path);
+
+#endif
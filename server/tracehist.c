@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// Buckets are powers of two of nanoseconds, from 1ns to over a minute
+#define HIST_BUCKETS   40
+#define HIST_BAR_WIDTH 40
+
+static const char *stage_names[TRACE_NR_STAGES] = {
+  [TRACE_RECV]     = "recv",
+  [TRACE_FRAMED]   = "framed",
+  [TRACE_LOCKED]   = "locked",
+  [TRACE_APPENDED] = "appended",
+  [TRACE_REPLIED]  = "replied",
+};
+
+// The latencies from one stage to the next one a record went through
+typedef struct samples {
+  uint64_t *ns;
+  size_t count;
+  size_t cap;
+}samples_t;
+
+// Indexed [from][to]. Totals are kept apart, so that they include the
+// records that went through the stages in between too.
+static samples_t intervals[TRACE_NR_STAGES][TRACE_NR_STAGES];
+static samples_t totals;
+
+static void samples_add(samples_t *s, uint64_t ns) {
+  if (s->count == s->cap) {
+    s->cap = s->cap > 0 ? s->cap * 2 : 1024;
+    s->ns = (uint64_t *)realloc(s->ns, s->cap * sizeof(uint64_t));
+    if (s->ns == NULL) {
+      perror("tracehist: memory allocation failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->ns[s->count++] = ns;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void format_ns(char *buf, size_t len, uint64_t ns) {
+  if (ns < 10000) {
+    snprintf(buf, len, "%luns", (unsigned long)ns);
+  } else if (ns < 10000000) {
+    snprintf(buf, len, "%.1fus", ns / 1e3);
+  } else {
+    snprintf(buf, len, "%.1fms", ns / 1e6);
+  }
+}
+
+static void print_histogram(const char *name, samples_t *s) {
+  if (s->count == 0) {
+    return;
+  }
+  qsort(s->ns, s->count, sizeof(uint64_t), compare_u64);
+
+  char p50[16], p90[16], p99[16], max[16];
+  format_ns(p50, sizeof(p50), s->ns[s->count * 50 / 100]);
+  format_ns(p90, sizeof(p90), s->ns[s->count * 90 / 100]);
+  format_ns(p99, sizeof(p99), s->ns[s->count * 99 / 100]);
+  format_ns(max, sizeof(max), s->ns[s->count - 1]);
+  printf("%s: %zu lines, p50 %s p90 %s p99 %s max %s\n", name, s->count, p50, p90, p99, max);
+
+  size_t buckets[HIST_BUCKETS] = { 0 };
+  size_t peak = 0;
+  int first = HIST_BUCKETS, last = 0;
+  for (size_t i = 0; i < s->count; i++) {
+    int b = s->ns[i] > 0 ? 64 - __builtin_clzll(s->ns[i]) : 0;
+    if (b >= HIST_BUCKETS) {
+      b = HIST_BUCKETS - 1;
+    }
+    buckets[b]++;
+    first = b < first ? b : first;
+    last = b > last ? b : last;
+  }
+  for (int b = first; b <= last; b++) {
+    peak = buckets[b] > peak ? buckets[b] : peak;
+  }
+  for (int b = first; b <= last; b++) {
+    char bound[16];
+    format_ns(bound, sizeof(bound), (uint64_t)1 << b);
+    int width = (int)(buckets[b] * HIST_BAR_WIDTH / peak);
+    printf("  < %8s %8zu |%.*s\n", bound, buckets[b], width,
+      "########################################");
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : TRACE_DUMP_PATH;
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror("tracehist: cannot open the trace");
+    exit(EXIT_FAILURE);
+  }
+
+  trace_file_header_t header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "tracehist: %s is not a trace\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if (header.nr_stages != TRACE_NR_STAGES || header.record_size != sizeof(uint64_t) * (2 + TRACE_NR_STAGES)) {
+    fprintf(stderr, "tracehist: %s was written by another version\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t record[2 + TRACE_NR_STAGES];
+  uint64_t read_records = 0;
+  while (fread(record, sizeof(record), 1, f) == 1) {
+    const uint64_t *ts = &record[2];
+    int prev = -1;
+    for (int stage = 0; stage < TRACE_NR_STAGES; stage++) {
+      if (ts[stage] == 0) {
+        continue;
+      }
+      if (prev >= 0) {
+        samples_add(&intervals[prev][stage], ts[stage] - ts[prev]);
+      }
+      prev = stage;
+    }
+    if (ts[TRACE_RECV] != 0 && ts[TRACE_REPLIED] != 0) {
+      samples_add(&totals, ts[TRACE_REPLIED] - ts[TRACE_RECV]);
+    }
+    read_records++;
+  }
+  fclose(f);
+  if (read_records != header.count) {
+    fprintf(stderr, "tracehist: %s is truncated, read %lu of %lu records\n", path,
+      (unsigned long)read_records, (unsigned long)header.count);
+  }
+
+  for (int from = 0; from < TRACE_NR_STAGES; from++) {
+    for (int to = from + 1; to < TRACE_NR_STAGES; to++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s -> %s", stage_names[from], stage_names[to]);
+      print_histogram(name, &intervals[from][to]);
+    }
+  }
+  print_histogram("total", &totals);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "unixsock.h"
+
+// Returns the length of the address or 0 if the path does not fit
+static socklen_t _unix_socket_address(const char *path, struct sockaddr_un *addr) {
+  bool abstract = path[0] == '@';
+  size_t path_len = strlen(path);
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path_len >= sizeof(addr->sun_path)) {
+    return 0;
+  }
+  memcpy(addr->sun_path, path, path_len);
+  if (abstract) {
+    addr->sun_path[0] = '\0';
+  }
+  // An abstract name is exactly as long as the address says, without a
+  // terminating NUL
+  return offsetof(struct sockaddr_un, sun_path) + path_len + (abstract ? 0 : 1);
+}
+
+int unix_socket_listen(const char *path) {
+  struct sockaddr_un addr;
+  socklen_t addr_len = _unix_socket_address(path, &addr);
+  if (addr_len == 0) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  unix_socket_unlink(path);
+
+  int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd == -1) {
+    return -1;
+  }
+  if (bind(sockfd, (struct sockaddr *)&addr, addr_len) != 0 || listen(sockfd, SOMAXCONN) != 0) {
+    int err = errno;
+    close(sockfd);
+    errno = err;
+    return -1;
+  }
+  return sockfd;
+}
+
+int unix_socket_connect(const char *path) {
+  struct sockaddr_un addr;
+  socklen_t addr_len = _unix_socket_address(path, &addr);
+  if (addr_len == 0) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd == -1) {
+    return -1;
+  }
+  if (connect(sockfd, (struct sockaddr *)&addr, addr_len) != 0) {
+    int err = errno;
+    close(sockfd);
+    errno = err;
+    return -1;
+  }
+  return sockfd;
+}
+
+void unix_socket_unlink(const char *path) {
+  if (path[0] != '@') {
+    unlink(path);
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef __AESDSOCKET_ASSIGNMENT_UNIXSOCK_H
+#define __AESDSOCKET_ASSIGNMENT_UNIXSOCK_H
+
+// Unix stream sockets named by a path, or by a name in the abstract
+// namespace when it starts with '@'. An abstract socket needs no file and
+// goes away with the last descriptor on it.
+
+// Binds and listens, replacing a socket file left behind by an earlier
+// run. Returns the socket or -1 with errno set.
+int unix_socket_listen(const char *path);
+
+// Returns the connected socket or -1 with errno set
+int unix_socket_connect(const char *path);
+
+// Removes the socket file, nothing to do for abstract names
+void unix_socket_unlink(const char *path);
+
+#endif